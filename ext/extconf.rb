@@ -4,4 +4,19 @@ Config::MAKEFILE_CONFIG["LDFLAGS"] <<' -L/usr/local/lib'
 
 init_mkmf
 have_library('onig')
-create_makefile('oniguruma')
\ No newline at end of file
+
+# Native worker threads and running searches without the interpreter lock
+have_library('pthread') if have_header('pthread.h')
+have_header('ruby/thread.h')
+have_func('rb_thread_call_without_gvl') || have_func('rb_thread_blocking_region')
+
+# Searching files through a memory mapping
+have_header('sys/mman.h')
+
+# The optimizer's required literal, read from regex_t (Oniguruma 5 and earlier)
+have_struct_member('regex_t', 'optimize', 'oniguruma.h')
+
+# Backtracking limits (Oniguruma 6.8 and later)
+have_func('onig_search_with_param', 'oniguruma.h')
+
+create_makefile('oniguruma')
@@ -25,6 +25,8 @@ Init_oniguruma()
   og_mOniguruma_Extension = rb_define_module_under(og_mOniguruma, OG_M_EXTENSIONS);
   
   og_oniguruma_oregexp(og_mOniguruma, OG_C_OREGEXP);
+  og_oniguruma_omatch(og_mOniguruma);
+  og_oniguruma_scanner(og_mOniguruma);
   
   og_oniguruma_string_ext(og_mOniguruma_Extension);
   og_oniguruma_match_ext(og_mOniguruma_Extension);
@@ -16,11 +16,32 @@
 #define OG_C_OREGEXP "ORegexp"
 #endif
 
+#ifndef OG_C_OMATCH
+#define OG_C_OMATCH "OMatch"
+#endif
+
+#ifndef OG_C_OSCANNER
+#define OG_C_OSCANNER "OScanner"
+#endif
+
 /* Init functions */
 void og_oniguruma_oregexp(VALUE mod, const char* name);
+void og_oniguruma_omatch(VALUE mod);
+void og_oniguruma_scanner(VALUE mod);
 void og_oniguruma_string_ext(VALUE mod);
 void og_oniguruma_match_ext(VALUE mod);
 
+/* Compiled program of an ORegexp, compiling lazy ones on demand */
+regex_t* og_oniguruma_oregexp_reg(VALUE self);
+
+/* ORegexp::Set */
+void og_oniguruma_set(VALUE klass);
+
+/* Compiled program analysis */
+void og_oniguruma_analysis(VALUE klass);
+int og_oniguruma_required_literal(regex_t *reg, const UChar **literal, long *length);
+void og_oniguruma_required_distance(regex_t *reg, long *dmin, long *dmax);
+
 /* Ruby to C constant mapping functions */
 OnigEncodingType* og_oniguruma_extract_encoding(VALUE encoding);
 OnigSyntaxType* og_oniguruma_extract_syntax(VALUE syntax);
@@ -30,13 +51,167 @@ VALUE og_oniguruma_gem_version();
 
 #define og_oniguruma_extract_option(opt) (OnigOptionType)NUM2INT(opt)
 
+#if ONIGURUMA_VERSION_MAJOR >= 5
+# ifndef enc_len
+#  define enc_len(enc, byte) ONIGENC_MBC_ENC_LEN(enc, byte)
+# endif
+#endif
+
+#ifndef OG_CACHE_DEFAULT_SIZE
+#define OG_CACHE_DEFAULT_SIZE 256
+#endif
+
+#ifndef OG_NOGVL_THRESHOLD_DEFAULT
+#define OG_NOGVL_THRESHOLD_DEFAULT (64 * 1024)
+#endif
+
+/* Everything which identifies a compiled pattern */
+typedef struct og_pattern_key {
+  const UChar *pattern;
+  long length;
+  OnigOptionType options;
+  OnigEncoding encoding;
+  OnigSyntaxType *syntax;
+  unsigned long hash;
+} og_PatternKey;
+
+/* Refcounted compiled pattern, shared through the pattern cache */
+typedef struct og_program {
+  regex_t *reg;
+  og_PatternKey key;          /* key.pattern is owned by the program */
+  int refcount;
+  int cached;
+  int windowed;               /* searches may be split into windows */
+  int start_dependent;        /* matches depend on the search start (\G) */
+  int literal_pattern;        /* OG_LITERAL_XXX if the pattern is a plain string */
+  const UChar *literal;       /* required literal, pointing into reg, or NULL */
+  long literal_length;
+  long literal_dmin;          /* offsets of the literal from the match start */
+  long literal_dmax;          /* -1 if unbounded */
+  struct og_program *chain;   /* cache bucket chain */
+  struct og_program *prev;    /* LRU list, most recently used first */
+  struct og_program *next;
+} og_Program;
+
+/* Search limits; -1 picks the ORegexp.default_xxx value, 0 means none */
+typedef struct og_search_limits {
+  long match_limit;         /* backtracking steps per match attempt */
+  double timeout;           /* seconds */
+} og_SearchLimits;
+
+/* Last search result of an ORegexp created with :memo => true */
+typedef struct og_search_memo og_SearchMemo;
+
 /* Oniguruma::ORegexp C class data structure */
 typedef struct og_oregexp {
   regex_t *reg;
+  og_Program *program;
+  og_Program *bare;         /* capture free program for predicates, or NULL */
+  OnigRegion *region;       /* spare region reused between matches */
+  VALUE pattern;            /* frozen copy of the source */
+  VALUE names;              /* frozen { :name => group } Hash, or nil */
+  OnigOptionType options;
+  int encoding;             /* Oniguruma::ENCODING_XXX value */
+  int syntax;               /* Oniguruma::SYNTAX_XXX value */
+  int last_match;           /* track last match: 1, 0, or -1 to follow the class */
+  og_SearchLimits limits;   /* :match_limit and :timeout */
+  og_SearchMemo *memo;      /* NULL unless :memo => true */
+  og_PatternKey key;        /* key.pattern points into pattern */
 } og_ORegexp;
 
+/* Defaults used when no :encoding or :syntax is given */
+#define OG_ENCODING_DEFAULT 1   /* Oniguruma::ENCODING_ASCII */
+#define OG_SYNTAX_DEFAULT   0   /* Oniguruma::SYNTAX_DEFAULT */
+
+/* Pattern cache functions */
+void og_oniguruma_cache(VALUE klass);
+void og_oniguruma_pattern_key_set(og_PatternKey *key, const UChar *pattern, long length,
+  OnigOptionType options, OnigEncoding encoding, OnigSyntaxType *syntax);
+int og_oniguruma_pattern_key_equal(const og_PatternKey *a, const og_PatternKey *b);
+og_Program* og_oniguruma_cache_lookup(const og_PatternKey *key);
+og_Program* og_oniguruma_program_new(regex_t *reg, const og_PatternKey *key);
+int og_oniguruma_program_fetch(og_Program **program, const og_PatternKey *key, OnigErrorInfo *error_info);
+void og_oniguruma_program_release(og_Program *program);
+
+/* Searching, without the interpreter lock for large subjects */
+void og_oniguruma_search(VALUE mod, VALUE klass);
+int og_oniguruma_search_string(og_Program *program, VALUE string, long start, long range,
+  OnigRegion *region, OnigOptionType option, const og_SearchLimits *limits);
+int og_oniguruma_search_string_found(og_Program *program, VALUE string, long found,
+  OnigRegion *region, OnigOptionType option, const og_SearchLimits *limits);
+int og_oniguruma_search_native(og_Program *program, const UChar *str, long length, long start, long range,
+  OnigRegion *region, OnigOptionType option);
+int og_oniguruma_search_bytes(og_Program *program, const UChar *str, long length, long start, long range,
+  OnigRegion *region, OnigOptionType option, const og_SearchLimits *limits);
+int og_oniguruma_search_windowed(const og_PatternKey *key);
+int og_oniguruma_search_start_dependent(const og_PatternKey *key);
+int og_oniguruma_search_literal_pattern(const og_PatternKey *key);
+void og_oniguruma_search_limits_parse(og_SearchLimits *limits, VALUE hash);
+void og_oniguruma_search_error(int result);
+const UChar* og_oniguruma_search_literal(const UChar *haystack, long length,
+  const UChar *needle, long needle_length);
+
+/* Scanning IO streams */
+void og_oniguruma_stream(VALUE klass);
+
+/* A file mapped, or read, into memory */
+typedef struct og_mapped_file {
+  const UChar *ptr;
+  long length;
+  int mapped;               /* ptr is a mapping rather than a malloc'ed copy */
+} og_MappedFile;
+
+/* Searching files */
+void og_oniguruma_file(VALUE klass);
+void og_oniguruma_file_open(og_MappedFile *file, VALUE path);
+void og_oniguruma_file_close(og_MappedFile *file);
+
+/* Scanning one subject on several threads */
+void og_oniguruma_parallel(VALUE klass);
+
+/* Search result memo */
+og_SearchMemo* og_oniguruma_memo_new(void);
+void og_oniguruma_memo_mark(og_SearchMemo *memo);
+void og_oniguruma_memo_free(og_SearchMemo *memo);
+int og_oniguruma_memo_lookup(og_SearchMemo *memo, VALUE string, long start, long range,
+  OnigOptionType option, OnigRegion *region, int *result);
+void og_oniguruma_memo_store(og_SearchMemo *memo, VALUE string, long start, long range,
+  OnigOptionType option, OnigRegion *region, int result);
+
+/* Plain string patterns, searched without the engine */
+#define OG_LITERAL_NONE   0
+#define OG_LITERAL_EXACT  1
+#define OG_LITERAL_ICASE  2   /* ASCII only, ignoring case */
+
+/* Returned by og_oniguruma_search_string when a limit was hit */
+#define OG_SEARCH_TIMEOUT (-10000)
+
 #define OG_STRING_PTR(str) (UChar*)(RSTRING_PTR(str))
 
+/*
+ * Calls func(data) with the interpreter lock released on Rubies which have
+ * one; ubf(ubf_data) is called to interrupt it. On 1.8 this is a plain call.
+ */
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+# ifdef HAVE_RUBY_THREAD_H
+#  include <ruby/thread.h>
+# endif
+# define og_oniguruma_without_gvl(func, data, ubf, ubf_data) \
+  rb_thread_call_without_gvl((func), (data), (ubf), (ubf_data))
+#elif defined(HAVE_RB_THREAD_BLOCKING_REGION)
+# define og_oniguruma_without_gvl(func, data, ubf, ubf_data) \
+  (void*)rb_thread_blocking_region((rb_blocking_function_t*)(func), (data), (ubf), (ubf_data))
+#else
+# define og_oniguruma_without_gvl(func, data, ubf, ubf_data) (func)(data)
+#endif
+
+/* Raises pending interrupts after running without the interpreter lock */
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL) || defined(HAVE_RB_THREAD_BLOCKING_REGION)
+# define og_oniguruma_check_ints() rb_thread_check_ints()
+#else
+# define og_oniguruma_check_ints()
+#endif
+
 #define DEBUG 1
 
 #ifdef DEBUG
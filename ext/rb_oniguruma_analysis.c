@@ -0,0 +1,263 @@
+#include "rb_oniguruma.h"
+
+/*
+ * The optimizer results live in the regex_t structure of Oniguruma 2 to 5,
+ * but the values describing them are only defined in regint.h, which
+ * Oniguruma does not install. These mirror the values used by those
+ * versions. From 6.0 on regex_t is opaque; extconf.rb then finds no
+ * regex_t.optimize, no required literal is reported and searches go
+ * without the prefilter.
+ */
+#if defined(HAVE_REGEX_T_OPTIMIZE) || defined(HAVE_ST_OPTIMIZE)
+# define OG_REGEX_INTERNALS 1
+#endif
+
+#ifdef OG_REGEX_INTERNALS
+#define OG_OPTIMIZE_NONE              0
+#define OG_OPTIMIZE_EXACT             1   /* Slow Search */
+#define OG_OPTIMIZE_EXACT_BM          2   /* Boyer Moore Search */
+#define OG_OPTIMIZE_EXACT_BM_NOT_REV  3   /* BM (but not simple match) */
+#define OG_OPTIMIZE_EXACT_IC          4   /* Slow Search (ignore case) */
+#define OG_OPTIMIZE_MAP               5   /* char map */
+
+#define OG_ANCHOR_BEGIN_BUF           (1<<0)
+#define OG_ANCHOR_BEGIN_LINE          (1<<1)
+#define OG_ANCHOR_BEGIN_POSITION      (1<<2)
+#define OG_ANCHOR_END_BUF             (1<<3)
+#define OG_ANCHOR_SEMI_END_BUF        (1<<4)
+#define OG_ANCHOR_END_LINE            (1<<5)
+#define OG_ANCHOR_ANYCHAR_STAR        (1<<14)
+#define OG_ANCHOR_ANYCHAR_STAR_ML     (1<<15)
+#endif
+
+/*
+ * Sets literal to the case sensitive string every match must contain, as
+ * chosen by the optimizer, and returns non-zero; returns 0 if there is none.
+ * The literal starts between reg->dmin and reg->dmax bytes after the start
+ * of the match.
+ */
+int
+og_oniguruma_required_literal(regex_t *reg, const UChar **literal, long *length)
+{
+#ifdef OG_REGEX_INTERNALS
+  switch (reg->optimize) {
+    case OG_OPTIMIZE_EXACT:
+    case OG_OPTIMIZE_EXACT_BM:
+    case OG_OPTIMIZE_EXACT_BM_NOT_REV:
+      if (reg->exact_end > reg->exact) {
+        *literal = reg->exact;
+        *length = reg->exact_end - reg->exact;
+        return 1;
+      }
+    default:
+      return 0;
+  }
+#else
+  return 0;
+#endif
+}
+
+/*
+ * Sets dmin and dmax to the range of byte offsets, from the start of a
+ * match, at which the required literal starts; dmax is -1 if unbounded.
+ */
+void
+og_oniguruma_required_distance(regex_t *reg, long *dmin, long *dmax)
+{
+#ifdef OG_REGEX_INTERNALS
+  *dmin = (long)reg->dmin;
+  *dmax = reg->dmax == ONIG_INFINITE_DISTANCE ? -1 : (long)reg->dmax;
+#else
+  *dmin = 0;
+  *dmax = -1;
+#endif
+}
+
+#ifdef OG_REGEX_INTERNALS
+static VALUE
+og_oniguruma_analysis_distance(OnigDistance distance)
+{
+  if (distance == ONIG_INFINITE_DISTANCE)
+    return Qnil;
+  return ULONG2NUM(distance);
+}
+
+static VALUE
+og_oniguruma_analysis_anchors(int anchor)
+{
+  VALUE anchors = rb_ary_new();
+
+  if (anchor & OG_ANCHOR_BEGIN_BUF)       rb_ary_push(anchors, ID2SYM(rb_intern("begin_buf")));
+  if (anchor & OG_ANCHOR_BEGIN_LINE)      rb_ary_push(anchors, ID2SYM(rb_intern("begin_line")));
+  if (anchor & OG_ANCHOR_BEGIN_POSITION)  rb_ary_push(anchors, ID2SYM(rb_intern("begin_position")));
+  if (anchor & OG_ANCHOR_END_BUF)         rb_ary_push(anchors, ID2SYM(rb_intern("end_buf")));
+  if (anchor & OG_ANCHOR_SEMI_END_BUF)    rb_ary_push(anchors, ID2SYM(rb_intern("semi_end_buf")));
+  if (anchor & OG_ANCHOR_END_LINE)        rb_ary_push(anchors, ID2SYM(rb_intern("end_line")));
+  if (anchor & OG_ANCHOR_ANYCHAR_STAR)    rb_ary_push(anchors, ID2SYM(rb_intern("anychar_star")));
+  if (anchor & OG_ANCHOR_ANYCHAR_STAR_ML) rb_ary_push(anchors, ID2SYM(rb_intern("anychar_star_ml")));
+
+  return anchors;
+}
+
+/*
+ * Document-method: analysis
+ *
+ * call-seq:
+ *    rxp.analysis   => hash
+ *
+ * Returns what the engine derived for the compiled pattern:
+ *
+ * <code>:optimization</code>::     how the search skips ahead, one of
+ *                                  <code>:none</code>, <code>:exact</code>,
+ *                                  <code>:exact_bm</code> (Boyer-Moore),
+ *                                  <code>:exact_bm_not_rev</code>,
+ *                                  <code>:exact_ic</code> (ignoring case) or
+ *                                  <code>:map</code> (first byte map).
+ * <code>:literal</code>::          the literal every match needs for the
+ *                                  exact optimizations, or <code>nil</code>.
+ * <code>:literal_offset</code>::   minimum and maximum distance of the
+ *                                  literal (or mapped byte) from the match
+ *                                  start, <code>nil</code> when unbounded.
+ * <code>:first_bytes</code>::      bytes a match may start with, for
+ *                                  <code>:map</code>.
+ * <code>:anchor</code>::           anchors of the whole pattern.
+ * <code>:sub_anchor</code>::       line anchors next to the literal or map.
+ * <code>:threshold_length</code>:: bytes needed from the match start before
+ *                                  the optimization is applied.
+ * <code>:end_anchor_length</code>:: minimum and maximum match length, which
+ *                                  the optimizer only works out for
+ *                                  patterns anchored at the end of the
+ *                                  subject; <code>nil</code> for all others,
+ *                                  so it is no general bound.
+ * <code>:captures</code>, <code>:names</code>, <code>:code_size</code>::
+ *                                  group counts and bytecode size.
+ *
+ * Against Oniguruma 6 and later, whose compiled patterns are opaque, only
+ * <code>:captures</code> and <code>:names</code> are known and the other
+ * values are <code>nil</code>.
+ *
+ *    ORegexp.new('ab?ERROR').analysis[:literal]          #=> "ERROR"
+ *    ORegexp.new('ab?ERROR').analysis[:literal_offset]   #=> [1, 2]
+ */
+static VALUE
+og_oniguruma_oregexp_analysis(VALUE self)
+{
+  int i;
+  regex_t *reg = og_oniguruma_oregexp_reg(self);
+  VALUE analysis, optimization, literal, first_bytes;
+
+  switch (reg->optimize) {
+    case OG_OPTIMIZE_EXACT:             optimization = ID2SYM(rb_intern("exact"));            break;
+    case OG_OPTIMIZE_EXACT_BM:          optimization = ID2SYM(rb_intern("exact_bm"));         break;
+    case OG_OPTIMIZE_EXACT_BM_NOT_REV:  optimization = ID2SYM(rb_intern("exact_bm_not_rev")); break;
+    case OG_OPTIMIZE_EXACT_IC:          optimization = ID2SYM(rb_intern("exact_ic"));         break;
+    case OG_OPTIMIZE_MAP:               optimization = ID2SYM(rb_intern("map"));              break;
+    default:                            optimization = ID2SYM(rb_intern("none"));             break;
+  }
+
+  literal = first_bytes = Qnil;
+
+  if (reg->optimize != OG_OPTIMIZE_NONE && reg->optimize != OG_OPTIMIZE_MAP && reg->exact_end > reg->exact)
+    literal = rb_str_new((char*)reg->exact, reg->exact_end - reg->exact);
+
+  if (reg->optimize == OG_OPTIMIZE_MAP) {
+    first_bytes = rb_str_buf_new(ONIG_CHAR_TABLE_SIZE);
+    for (i = 0; i < ONIG_CHAR_TABLE_SIZE; i++) {
+      if (reg->map[i]) {
+        char byte = (char)i;
+        rb_str_buf_cat(first_bytes, &byte, 1);
+      }
+    }
+  }
+
+  analysis = rb_hash_new();
+  rb_hash_aset(analysis, ID2SYM(rb_intern("optimization")), optimization);
+  rb_hash_aset(analysis, ID2SYM(rb_intern("literal")), literal);
+  rb_hash_aset(analysis, ID2SYM(rb_intern("literal_offset")),
+    reg->optimize == OG_OPTIMIZE_NONE ? Qnil :
+      rb_assoc_new(og_oniguruma_analysis_distance(reg->dmin), og_oniguruma_analysis_distance(reg->dmax)));
+  rb_hash_aset(analysis, ID2SYM(rb_intern("first_bytes")), first_bytes);
+  rb_hash_aset(analysis, ID2SYM(rb_intern("anchor")), og_oniguruma_analysis_anchors(reg->anchor));
+  rb_hash_aset(analysis, ID2SYM(rb_intern("sub_anchor")), og_oniguruma_analysis_anchors(reg->sub_anchor));
+  rb_hash_aset(analysis, ID2SYM(rb_intern("threshold_length")), INT2NUM(reg->threshold_len));
+
+  rb_hash_aset(analysis, ID2SYM(rb_intern("end_anchor_length")),
+    !(reg->anchor & (OG_ANCHOR_END_BUF | OG_ANCHOR_SEMI_END_BUF)) ? Qnil :
+      rb_assoc_new(og_oniguruma_analysis_distance(reg->anchor_dmin), og_oniguruma_analysis_distance(reg->anchor_dmax)));
+
+  rb_hash_aset(analysis, ID2SYM(rb_intern("captures")), INT2NUM(onig_number_of_captures(reg)));
+  rb_hash_aset(analysis, ID2SYM(rb_intern("names")), INT2NUM(onig_number_of_names(reg)));
+  rb_hash_aset(analysis, ID2SYM(rb_intern("code_size")), UINT2NUM(reg->used));
+
+  return analysis;
+}
+#else
+static VALUE
+og_oniguruma_oregexp_analysis(VALUE self)
+{
+  int i;
+  regex_t *reg = og_oniguruma_oregexp_reg(self);
+  VALUE analysis = rb_hash_new();
+  static const char *unknown[] = { "optimization", "literal", "literal_offset", "first_bytes",
+    "anchor", "sub_anchor", "threshold_length", "end_anchor_length", "code_size" };
+
+  for (i = 0; i < (int)(sizeof(unknown) / sizeof(unknown[0])); i++)
+    rb_hash_aset(analysis, ID2SYM(rb_intern(unknown[i])), Qnil);
+
+  rb_hash_aset(analysis, ID2SYM(rb_intern("captures")), INT2NUM(onig_number_of_captures(reg)));
+  rb_hash_aset(analysis, ID2SYM(rb_intern("names")), INT2NUM(onig_number_of_names(reg)));
+
+  return analysis;
+}
+#endif
+
+/*
+ * Document-method: bytecode
+ *
+ * call-seq:
+ *    rxp.bytecode   => str
+ *
+ * Returns a raw hex dump of the compiled bytecode, sixteen bytes per line
+ * and prefixed with the offset. The opcodes are not decoded: their numbers
+ * and operand layouts are internal to each Oniguruma release. Useful to
+ * compare code sizes, or to diff two patterns. Raises
+ * <code>NotImplementedError</code> against Oniguruma 6 and later.
+ *
+ *    puts ORegexp.new('ab+').bytecode
+ *    # 0000: 0e 61 ...
+ */
+static VALUE
+og_oniguruma_oregexp_bytecode(VALUE self)
+{
+#ifdef OG_REGEX_INTERNALS
+  unsigned int i;
+  char line[8 + 16 * 3 + 2];
+  int len = 0;
+  regex_t *reg = og_oniguruma_oregexp_reg(self);
+  VALUE dump = rb_str_buf_new(reg->used * 3 + (reg->used / 16 + 1) * 7);
+
+  for (i = 0; i < reg->used; i++) {
+    if (i % 16 == 0)
+      len = snprintf(line, sizeof(line), "%04x:", i);
+
+    len += snprintf(line + len, sizeof(line) - len, " %02x", reg->p[i]);
+
+    if (i % 16 == 15 || i + 1 == reg->used) {
+      line[len++] = '\n';
+      rb_str_buf_cat(dump, line, len);
+    }
+  }
+
+  return dump;
+#else
+  rb_raise(rb_eNotImpError, "bytecode needs the regex_t of Oniguruma 5 or earlier");
+  return Qnil;
+#endif
+}
+
+void
+og_oniguruma_analysis(VALUE klass)
+{
+  rb_define_method(klass, "analysis",     og_oniguruma_oregexp_analysis,     0);
+  rb_define_method(klass, "bytecode",     og_oniguruma_oregexp_bytecode,     0);
+}
@@ -0,0 +1,335 @@
+#include "rb_oniguruma.h"
+
+/*
+ * Process wide cache of compiled patterns.
+ *
+ * ORegexp objects with the same pattern bytes, options, encoding and syntax
+ * share one refcounted og_Program. The cache holds its own reference to
+ * each program and evicts the least recently used one once it is full; a
+ * program evicted while ORegexp objects still use it lives on until the last
+ * of them is freed.
+ *
+ * All cache access happens with the interpreter lock held.
+ */
+typedef struct og_pattern_cache {
+  og_Program **buckets;
+  long bucket_count;    /* always a power of two */
+  long size;
+  long capacity;
+  og_Program *head;     /* most recently used */
+  og_Program *tail;     /* least recently used */
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+} og_PatternCache;
+
+static og_PatternCache og_cache = { NULL, 0, 0, OG_CACHE_DEFAULT_SIZE, NULL, NULL, 0, 0, 0 };
+
+#define og_oniguruma_cache_bucket(h) (og_cache.buckets[(h) & (og_cache.bucket_count - 1)])
+
+/* FNV-1a over the pattern bytes, mixed with the rest of the key */
+void
+og_oniguruma_pattern_key_set(og_PatternKey *key, const UChar *pattern, long length,
+  OnigOptionType options, OnigEncoding encoding, OnigSyntaxType *syntax)
+{
+  long i;
+  unsigned long h = 2166136261UL;
+
+  for (i = 0; i < length; i++) {
+    h ^= pattern[i];
+    h *= 16777619UL;
+  }
+
+  h ^= (unsigned long)options;            h *= 16777619UL;
+  h ^= (unsigned long)(size_t)encoding;   h *= 16777619UL;
+  h ^= (unsigned long)(size_t)syntax;     h *= 16777619UL;
+
+  key->pattern  = pattern;
+  key->length   = length;
+  key->options  = options;
+  key->encoding = encoding;
+  key->syntax   = syntax;
+  key->hash     = h;
+}
+
+int
+og_oniguruma_pattern_key_equal(const og_PatternKey *a, const og_PatternKey *b)
+{
+  return a->hash == b->hash         &&
+    a->length   == b->length        &&
+    a->options  == b->options       &&
+    a->encoding == b->encoding      &&
+    a->syntax   == b->syntax        &&
+    memcmp(a->pattern, b->pattern, a->length) == 0;
+}
+
+static void
+og_oniguruma_program_free(og_Program *program)
+{
+  onig_free(program->reg);
+  free((void*)program->key.pattern);
+  free(program);
+}
+
+void
+og_oniguruma_program_release(og_Program *program)
+{
+  if (program != NULL && --program->refcount == 0)
+    og_oniguruma_program_free(program);
+}
+
+static void
+og_oniguruma_cache_lru_unlink(og_Program *program)
+{
+  if (program->prev) program->prev->next = program->next;
+  else og_cache.head = program->next;
+
+  if (program->next) program->next->prev = program->prev;
+  else og_cache.tail = program->prev;
+
+  program->prev = program->next = NULL;
+}
+
+static void
+og_oniguruma_cache_lru_push(og_Program *program)
+{
+  program->prev = NULL;
+  program->next = og_cache.head;
+
+  if (og_cache.head) og_cache.head->prev = program;
+  else og_cache.tail = program;
+
+  og_cache.head = program;
+}
+
+static void
+og_oniguruma_cache_remove(og_Program *program)
+{
+  og_Program **link = &og_oniguruma_cache_bucket(program->key.hash);
+
+  while (*link != program)
+    link = &(*link)->chain;
+  *link = program->chain;
+
+  og_oniguruma_cache_lru_unlink(program);
+  program->chain = NULL;
+  program->cached = 0;
+  og_cache.size--;
+
+  og_oniguruma_program_release(program);
+}
+
+static void
+og_oniguruma_cache_trim(long capacity)
+{
+  while (og_cache.size > capacity && og_cache.tail != NULL) {
+    og_oniguruma_cache_remove(og_cache.tail);
+    og_cache.evictions++;
+  }
+}
+
+static void
+og_oniguruma_cache_rehash(long capacity)
+{
+  long count = 16;
+  og_Program *program;
+
+  while (count < capacity * 2)
+    count <<= 1;
+
+  if (count == og_cache.bucket_count)
+    return;
+
+  free(og_cache.buckets);
+  og_cache.buckets = calloc(count, sizeof(og_Program*));
+  og_cache.bucket_count = count;
+
+  for (program = og_cache.head; program != NULL; program = program->next) {
+    program->chain = og_oniguruma_cache_bucket(program->key.hash);
+    og_oniguruma_cache_bucket(program->key.hash) = program;
+  }
+}
+
+/* Returns a retained program for key, or NULL on a miss */
+og_Program*
+og_oniguruma_cache_lookup(const og_PatternKey *key)
+{
+  og_Program *program;
+
+  if (og_cache.capacity == 0 || og_cache.buckets == NULL) {
+    og_cache.misses++;
+    return NULL;
+  }
+
+  for (program = og_oniguruma_cache_bucket(key->hash); program != NULL; program = program->chain) {
+    if (og_oniguruma_pattern_key_equal(&program->key, key)) {
+      og_oniguruma_cache_lru_unlink(program);
+      og_oniguruma_cache_lru_push(program);
+
+      og_cache.hits++;
+      program->refcount++;
+      return program;
+    }
+  }
+
+  og_cache.misses++;
+  return NULL;
+}
+
+/* Wraps a freshly compiled reg, taking ownership of it, and caches it */
+og_Program*
+og_oniguruma_program_new(regex_t *reg, const og_PatternKey *key)
+{
+  UChar *pattern;
+  og_Program *program;
+
+  program = malloc(sizeof(og_Program));
+  pattern = malloc(key->length + 1);
+  memcpy(pattern, key->pattern, key->length);
+  pattern[key->length] = '\0';
+
+  program->reg = reg;
+  program->key = *key;
+  program->key.pattern = pattern;
+  program->refcount = 1;
+  program->cached = 0;
+  program->windowed = og_oniguruma_search_windowed(key);
+  program->start_dependent = og_oniguruma_search_start_dependent(key);
+  program->literal_pattern = og_oniguruma_search_literal_pattern(key);
+  if (!og_oniguruma_required_literal(reg, &program->literal, &program->literal_length))
+    program->literal = NULL;
+  og_oniguruma_required_distance(reg, &program->literal_dmin, &program->literal_dmax);
+  program->chain = program->prev = program->next = NULL;
+
+  if (og_cache.capacity > 0) {
+    if (og_cache.buckets == NULL)
+      og_oniguruma_cache_rehash(og_cache.capacity);
+
+    og_oniguruma_cache_trim(og_cache.capacity - 1);
+
+    program->chain = og_oniguruma_cache_bucket(key->hash);
+    og_oniguruma_cache_bucket(key->hash) = program;
+    og_oniguruma_cache_lru_push(program);
+
+    program->cached = 1;
+    program->refcount++;
+    og_cache.size++;
+  }
+
+  return program;
+}
+
+/*
+ * Looks key up in the cache, compiling and caching it on a miss. Returns
+ * ONIG_NORMAL and a retained program, or the onig_new error code.
+ */
+int
+og_oniguruma_program_fetch(og_Program **program, const og_PatternKey *key, OnigErrorInfo *error_info)
+{
+  int result;
+  regex_t *reg;
+
+  *program = og_oniguruma_cache_lookup(key);
+  if (*program != NULL)
+    return ONIG_NORMAL;
+
+  result = onig_new(&reg, (UChar*)key->pattern, (UChar*)key->pattern + key->length,
+    key->options, key->encoding, key->syntax, error_info);
+
+  if (result != ONIG_NORMAL)
+    return result;
+
+  *program = og_oniguruma_program_new(reg, key);
+  return ONIG_NORMAL;
+}
+
+/*
+ * Document-method: cache_size
+ *
+ * call-seq:
+ *    ORegexp.cache_size   => int
+ *
+ * Returns the maximum number of compiled patterns kept in the pattern cache.
+ */
+static VALUE
+og_oniguruma_cache_size(VALUE self)
+{
+  return LONG2NUM(og_cache.capacity);
+}
+
+/*
+ * Document-method: cache_size=
+ *
+ * call-seq:
+ *    ORegexp.cache_size = int
+ *
+ * Sets the maximum number of compiled patterns kept in the pattern cache,
+ * evicting the least recently used ones if needed. A size of 0 disables the
+ * cache.
+ */
+static VALUE
+og_oniguruma_cache_set_size(VALUE self, VALUE size)
+{
+  long capacity = NUM2LONG(size);
+
+  if (capacity < 0)
+    rb_raise(rb_eArgError, "negative cache size");
+
+  og_oniguruma_cache_trim(capacity);
+  og_cache.capacity = capacity;
+
+  if (capacity > 0)
+    og_oniguruma_cache_rehash(capacity);
+
+  return size;
+}
+
+/*
+ * Document-method: cache_stats
+ *
+ * call-seq:
+ *    ORegexp.cache_stats   => hash
+ *
+ * Returns the pattern cache counters.
+ *
+ *    ORegexp.cache_stats   #=> {:hits=>10, :misses=>2, :evictions=>0, :size=>2, :capacity=>256}
+ */
+static VALUE
+og_oniguruma_cache_stats(VALUE self)
+{
+  VALUE stats = rb_hash_new();
+
+  rb_hash_aset(stats, ID2SYM(rb_intern("hits")),      ULONG2NUM(og_cache.hits));
+  rb_hash_aset(stats, ID2SYM(rb_intern("misses")),    ULONG2NUM(og_cache.misses));
+  rb_hash_aset(stats, ID2SYM(rb_intern("evictions")), ULONG2NUM(og_cache.evictions));
+  rb_hash_aset(stats, ID2SYM(rb_intern("size")),      LONG2NUM(og_cache.size));
+  rb_hash_aset(stats, ID2SYM(rb_intern("capacity")),  LONG2NUM(og_cache.capacity));
+
+  return stats;
+}
+
+/*
+ * Document-method: clear_cache
+ *
+ * call-seq:
+ *    ORegexp.clear_cache   => nil
+ *
+ * Drops every compiled pattern from the pattern cache and resets its
+ * counters. Existing ORegexp objects are not affected.
+ */
+static VALUE
+og_oniguruma_cache_clear(VALUE self)
+{
+  og_oniguruma_cache_trim(0);
+  og_cache.hits = og_cache.misses = og_cache.evictions = 0;
+  return Qnil;
+}
+
+void
+og_oniguruma_cache(VALUE klass)
+{
+  rb_define_singleton_method(klass, "cache_size",   og_oniguruma_cache_size,      0);
+  rb_define_singleton_method(klass, "cache_size=",  og_oniguruma_cache_set_size,  1);
+  rb_define_singleton_method(klass, "cache_stats",  og_oniguruma_cache_stats,     0);
+  rb_define_singleton_method(klass, "clear_cache",  og_oniguruma_cache_clear,     0);
+}
@@ -6,25 +6,28 @@ typedef struct og_string_substitution_args {
   VALUE oregexp;
   VALUE method;
   VALUE string;
+  VALUE options;            /* { :match_limit, :timeout } Hash, or nil */
 } og_StringSubstitutionArgs;
 
-#define og_StringSubstitutionArgs_set(args_, a, b, c) do {  \
-  og_StringSubstitutionArgs *ssap = (args_);                \
-  (ssap)->oregexp = a;                                      \
-  (ssap)->method = b;                                       \
-  (ssap)->string = c;                                       \
+#define og_StringSubstitutionArgs_set(args_, a, b, c, d) do {  \
+  og_StringSubstitutionArgs *ssap = (args_);                   \
+  (ssap)->oregexp = a;                                         \
+  (ssap)->method = b;                                          \
+  (ssap)->string = c;                                          \
+  (ssap)->options = d;                                         \
 } while(0)
 
 static VALUE
 og_oniguruma_string_do_substitution_block(VALUE val)
 {
-  VALUE argv[2];
+  VALUE argv[3];
   og_StringSubstitutionArgs *args = (og_StringSubstitutionArgs *)val;
   
   argv[0] = args->string;
-  argv[1] = (VALUE)NULL;
+  argv[1] = args->options;
+  argv[2] = (VALUE)NULL;
   
-  return rb_funcall3(args->oregexp, args->method, 1, argv);
+  return rb_funcall3(args->oregexp, args->method, NIL_P(args->options) ? 1 : 2, argv);
 }
 
 // The block will be yielded a MatchData object or nil
@@ -48,30 +51,38 @@ static VALUE
 og_oniguruma_string_do_substitution(VALUE self, char *method, int argc, VALUE *argv)
 {
   og_DefineConstantNames;
-  VALUE oregexp, re, arg, oargv[2], nargv[3];
+  VALUE oregexp, re, arg, options, oargv[2], nargv[4];
   og_StringSubstitutionArgs fargs;
   
   og_ObtainConstants;
   if (rb_block_given_p()) {
-    rb_scan_args(argc, argv, "1&", &re, &arg);
+    rb_scan_args(argc, argv, "11&", &re, &options, &arg);
   } else {
-    rb_scan_args(argc, argv, "2", &re, &arg);
+    rb_scan_args(argc, argv, "21", &re, &arg, &options);
   }
+  if (!NIL_P(options))
+    Check_Type(options, T_HASH);
   
-  oargv[0] = re;
-  oargv[1] = (VALUE)NULL;
-  oregexp = rb_class_new_instance(1, oargv, og_cOniguruma_ORegexp);
+  if (rb_obj_is_kind_of(re, og_cOniguruma_ORegexp)) {
+    oregexp = re;
+  } else {
+    /* Compiled programs come from the ORegexp pattern cache */
+    oargv[0] = re;
+    oargv[1] = (VALUE)NULL;
+    oregexp = rb_class_new_instance(1, oargv, og_cOniguruma_ORegexp);
+  }
   
   if (rb_block_given_p()) {
-    og_StringSubstitutionArgs_set(&fargs, oregexp, rb_intern(method), self);
+    og_StringSubstitutionArgs_set(&fargs, oregexp, rb_intern(method), self, options);
     return rb_iterate(og_oniguruma_string_do_substitution_block, (VALUE)&fargs,
       og_oniguruma_string_block_helper, (VALUE)arg);
   } else {
     nargv[0] = self;
     nargv[1] = arg;
-    nargv[2] = (VALUE)NULL;
+    nargv[2] = options;
+    nargv[3] = (VALUE)NULL;
 
-    return rb_funcall3(oregexp, rb_intern(method), 2, nargv);
+    return rb_funcall3(oregexp, rb_intern(method), NIL_P(options) ? 2 : 3, nargv);
   }
 }
 
@@ -79,9 +90,12 @@ og_oniguruma_string_do_substitution(VALUE self, char *method, int argc, VALUE *a
  * Document-method: ogsub
  *
  * call-seq:
- *   ogsub(*args)
+ *   ogsub(pattern, replacement, options_hash=nil)
+ *   ogsub(pattern, options_hash=nil) {|match| ... }
  *
- * Calls <code>Oniguruma::ORegexp#gsub</code> on this string.
+ * Calls <code>Oniguruma::ORegexp#gsub</code> on this string. <i>pattern</i>
+ * is an ORegexp or a pattern String; <code>:match_limit</code> and
+ * <code>:timeout</code> in <i>options_hash</i> apply to this call.
  */
 static VALUE
 og_oniguruma_string_ogsub(int argc, VALUE *argv, VALUE self)
@@ -93,9 +107,12 @@ og_oniguruma_string_ogsub(int argc, VALUE *argv, VALUE self)
  * Document-method: ogsub!
  *
  * call-seq:
- *   ogsub!(*args)
+ *   ogsub!(pattern, replacement, options_hash=nil)
+ *   ogsub!(pattern, options_hash=nil) {|match| ... }
  *
- * Calls <code>Oniguruma::ORegexp#gsub!</code> on this string.
+ * Calls <code>Oniguruma::ORegexp#gsub!</code> on this string. <i>pattern</i>
+ * is an ORegexp or a pattern String; <code>:match_limit</code> and
+ * <code>:timeout</code> in <i>options_hash</i> apply to this call.
  */
 static VALUE
 og_oniguruma_string_ogsub_bang(int argc, VALUE *argv, VALUE self)
@@ -107,9 +124,12 @@ og_oniguruma_string_ogsub_bang(int argc, VALUE *argv, VALUE self)
  * Document-method: osub
  *
  * call-seq:
- *   osub(*args)
+ *   osub(pattern, replacement, options_hash=nil)
+ *   osub(pattern, options_hash=nil) {|match| ... }
  *
- * Calls <code>Oniguruma::ORegexp#sub</code> on this string.
+ * Calls <code>Oniguruma::ORegexp#sub</code> on this string. <i>pattern</i>
+ * is an ORegexp or a pattern String; <code>:match_limit</code> and
+ * <code>:timeout</code> in <i>options_hash</i> apply to this call.
  */
 static VALUE
 og_oniguruma_string_osub(int argc, VALUE *argv, VALUE self)
@@ -121,9 +141,12 @@ og_oniguruma_string_osub(int argc, VALUE *argv, VALUE self)
  * Document-method: osub!
  *
  * call-seq:
- *   osub!(*args)
+ *   osub!(pattern, replacement, options_hash=nil)
+ *   osub!(pattern, options_hash=nil) {|match| ... }
  *
- * Calls <code>Oniguruma::ORegexp#sub!</code> on this string.
+ * Calls <code>Oniguruma::ORegexp#sub!</code> on this string. <i>pattern</i>
+ * is an ORegexp or a pattern String; <code>:match_limit</code> and
+ * <code>:timeout</code> in <i>options_hash</i> apply to this call.
  */
 static VALUE
 og_oniguruma_string_osub_bang(int argc, VALUE *argv, VALUE self)
@@ -0,0 +1,258 @@
+#include "rb_oniguruma.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+/*
+ * Searching files on disk. Files are mapped into memory where mmap is
+ * available, and read into a malloc'ed buffer elsewhere; either way no Ruby
+ * String holds the contents, and searches of large files run without the
+ * interpreter lock. The kernel is told the mapping is read sequentially, so
+ * it reads ahead and drops pages behind the search.
+ */
+typedef struct og_file_args {
+  VALUE self;
+  VALUE path;
+  og_MappedFile file;
+  og_SearchLimits limits;
+  OnigRegion *region;
+  int substrings;           /* yield or collect Strings rather than offsets */
+  int count_only;
+  VALUE results;            /* Array, or nil with a block */
+} og_FileArgs;
+
+static const UChar og_empty_file[1] = { 0 };
+
+/* Maps, or reads, the file at path; raises SystemCallError on failure */
+void
+og_oniguruma_file_open(og_MappedFile *file, VALUE path)
+{
+  int fd;
+  struct stat st;
+  const char *name;
+
+  FilePathValue(path);
+  name = StringValueCStr(path);
+
+  file->ptr = og_empty_file;
+  file->length = 0;
+  file->mapped = 0;
+
+  fd = open(name, O_RDONLY);
+  if (fd < 0)
+    rb_sys_fail(name);
+
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    rb_sys_fail(name);
+  }
+
+  if (st.st_size == 0) {
+    close(fd);
+    return;
+  }
+
+  /* Oniguruma offsets are ints */
+  if (st.st_size > INT_MAX) {
+    close(fd);
+    rb_raise(rb_eArgError, "%s: file too large to search", name);
+  }
+
+#ifdef HAVE_SYS_MMAN_H
+  file->ptr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (file->ptr == MAP_FAILED) {
+    file->ptr = og_empty_file;
+    close(fd);
+    rb_sys_fail(name);
+  }
+  file->length = (long)st.st_size;
+  file->mapped = 1;
+# ifdef MADV_SEQUENTIAL
+  madvise((void*)file->ptr, (size_t)file->length, MADV_SEQUENTIAL);
+# endif
+#else
+  {
+    long done = 0, n;
+    UChar *buffer = malloc((size_t)st.st_size);
+
+    while (done < (long)st.st_size) {
+      n = read(fd, buffer + done, (size_t)(st.st_size - done));
+      if (n <= 0)
+        break;
+      done += n;
+    }
+
+    if (done < (long)st.st_size) {
+      free(buffer);
+      close(fd);
+      rb_sys_fail(name);
+    }
+
+    file->ptr = buffer;
+    file->length = done;
+  }
+#endif
+
+  close(fd);
+}
+
+void
+og_oniguruma_file_close(og_MappedFile *file)
+{
+  if (file->length == 0)
+    return;
+
+#ifdef HAVE_SYS_MMAN_H
+  if (file->mapped)
+    munmap((void*)file->ptr, (size_t)file->length);
+#else
+  free((void*)file->ptr);
+#endif
+
+  file->ptr = og_empty_file;
+  file->length = 0;
+}
+
+static VALUE
+og_oniguruma_file_do_scan(og_FileArgs *args)
+{
+  int result;
+  long count = 0, start = 0, end;
+  const UChar *str;
+  og_ORegexp *oregexp;
+  VALUE found;
+
+  og_oniguruma_oregexp_reg(args->self);
+  Data_Get_Struct(args->self, og_ORegexp, oregexp);
+
+  og_oniguruma_file_open(&args->file, args->path);
+  str = args->file.ptr;
+
+  while (start <= args->file.length) {
+    result = og_oniguruma_search_bytes(oregexp->program, str, args->file.length, start, args->file.length,
+      args->region, ONIG_OPTION_NONE, &args->limits);
+
+    if (result == ONIG_MISMATCH)
+      break;
+    if (result < 0)
+      og_oniguruma_search_error(result);
+
+    end = args->region->end[0];
+    count++;
+
+    if (!args->count_only) {
+      if (args->substrings)
+        found = rb_str_new((const char*)str + result, end - result);
+      else
+        found = rb_assoc_new(LONG2NUM(result), LONG2NUM(end));
+
+      if (NIL_P(args->results))
+        rb_yield(found);
+      else
+        rb_ary_push(args->results, found);
+    }
+
+    if (end == result) {
+      if (end >= args->file.length)
+        break;
+      end += enc_len(oregexp->key.encoding, str + end);
+    }
+    start = end;
+  }
+
+  if (args->count_only || NIL_P(args->results))
+    return LONG2NUM(count);
+  return args->results;
+}
+
+static VALUE
+og_oniguruma_file_cleanup(og_FileArgs *args)
+{
+  og_oniguruma_file_close(&args->file);
+  onig_region_free(args->region, 1);
+  return Qnil;
+}
+
+static VALUE
+og_oniguruma_file_run(int argc, VALUE *argv, VALUE self, int count_only)
+{
+  og_ORegexp *oregexp;
+  og_FileArgs args;
+  VALUE path, options;
+
+  rb_scan_args(argc, argv, "11", &path, &options);
+  if (!NIL_P(options))
+    Check_Type(options, T_HASH);
+
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+
+  args.self = self;
+  args.path = path;
+  args.file.ptr = og_empty_file;
+  args.file.length = 0;
+  args.file.mapped = 0;
+  args.limits = oregexp->limits;
+  args.substrings = 0;
+  args.count_only = count_only;
+  args.results = (count_only || rb_block_given_p()) ? Qnil : rb_ary_new();
+
+  if (!NIL_P(options)) {
+    og_oniguruma_search_limits_parse(&args.limits, options);
+    args.substrings = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("substrings"))));
+  }
+
+  args.region = onig_region_new();
+
+  return rb_ensure(og_oniguruma_file_do_scan, (VALUE)&args,
+    og_oniguruma_file_cleanup, (VALUE)&args);
+}
+
+/*
+ * Document-method: scan_file
+ *
+ * call-seq:
+ *    rxp.scan_file(path, options_hash=nil)                => [[begin, end], ...]
+ *    rxp.scan_file(path, options_hash=nil) {|pair| ... }  => int
+ *
+ * Scans the file at <i>path</i> without reading it into a String. Returns
+ * the byte offsets of every match, or yields them and returns the number of
+ * matches. With <code>:substrings => true</code> the matched Strings are
+ * returned or yielded instead. <code>:match_limit</code> and
+ * <code>:timeout</code> apply to each search.
+ *
+ *    ORegexp.new('ERROR').scan_file('app.log').first   #=> [1532, 1537]
+ */
+static VALUE
+og_oniguruma_file_scan_file(int argc, VALUE *argv, VALUE self)
+{
+  return og_oniguruma_file_run(argc, argv, self, 0);
+}
+
+/*
+ * Document-method: count_file
+ *
+ * call-seq:
+ *    rxp.count_file(path, options_hash=nil)   => int
+ *
+ * Returns the number of matches in the file at <i>path</i>, without
+ * reading it into a String or creating any objects per match.
+ */
+static VALUE
+og_oniguruma_file_count_file(int argc, VALUE *argv, VALUE self)
+{
+  return og_oniguruma_file_run(argc, argv, self, 1);
+}
+
+void
+og_oniguruma_file(VALUE klass)
+{
+  rb_define_method(klass, "scan_file",   og_oniguruma_file_scan_file,   -1);
+  rb_define_method(klass, "count_file",  og_oniguruma_file_count_file,  -1);
+}
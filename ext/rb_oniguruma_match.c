@@ -14,24 +14,27 @@ og_oniguruma_oregexp_match_alloc()
   return (VALUE)match;
 }
 
+/*
+ * Moves the register arrays of region into a new MatchData instead of
+ * copying them; the region is left empty and is refilled by the next
+ * search. Both sides allocate and free the arrays with the C library.
+ */
 VALUE
 og_oniguruma_match_initialize(OnigRegion *region, VALUE string)
 {
-  int i;
   VALUE match = og_oniguruma_oregexp_match_alloc();
   
   RMATCH(match)->str = rb_str_new4(string);
   
   RMATCH(match)->regs->num_regs = region->num_regs;
-  RMATCH(match)->regs->allocated = region->num_regs;
-  
-  RMATCH(match)->regs->beg = ALLOC_N(int, region->num_regs);
-  RMATCH(match)->regs->end = ALLOC_N(int, region->num_regs);
-  
-  for (i = 0; i < region->num_regs; i++) {
-    RMATCH(match)->regs->beg[i] = region->beg[i];
-    RMATCH(match)->regs->end[i] = region->end[i];
-  }
+  RMATCH(match)->regs->allocated = region->allocated;
+  RMATCH(match)->regs->beg = region->beg;
+  RMATCH(match)->regs->end = region->end;
+  
+  region->allocated = 0;
+  region->num_regs = 0;
+  region->beg = NULL;
+  region->end = NULL;
   
   return match;
 }
@@ -23,6 +23,9 @@ typedef struct og_callback_packet {
 /* Our Match methods */
 VALUE og_oniguruma_match_initialize(OnigRegion *region, VALUE string);
 
+/* Lightweight match results, copying the offsets out of region */
+VALUE og_oniguruma_omatch_new(OnigRegion *region, VALUE string, VALUE names);
+
 /* v2 uses UChar, v4+ uses const UChar for the callback */
 #if ONIGURUMA_VERSION_MAJOR < 4
 # define OG_CALLBACK_UCHAR UChar
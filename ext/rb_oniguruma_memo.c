@@ -0,0 +1,102 @@
+#include "rb_oniguruma.h"
+
+/*
+ * Search result memo of an ORegexp created with :memo => true.
+ *
+ * Tokenizers search one line again and again from increasing start
+ * positions. A match found at p when searching from start is also the
+ * answer for any later start up to p, and a mismatch stays a mismatch for
+ * later starts, so the last result answers those searches without running
+ * the engine.
+ *
+ * The memo keeps a frozen copy sharing the subject's buffer. Modifying the
+ * subject then gives it a buffer of its own, so an unchanged buffer pointer
+ * means unchanged contents; short embedded strings are compared instead.
+ */
+struct og_search_memo {
+  VALUE snapshot;           /* frozen copy of the subject, or nil */
+  VALUE string;             /* the subject itself */
+  const char *ptr;
+  long length;
+  long start, range;
+  OnigOptionType option;
+  int result;               /* match position or ONIG_MISMATCH */
+  OnigRegion *region;
+};
+
+og_SearchMemo*
+og_oniguruma_memo_new(void)
+{
+  og_SearchMemo *memo = malloc(sizeof(og_SearchMemo));
+
+  memo->snapshot = memo->string = Qnil;
+  memo->ptr = NULL;
+  memo->region = onig_region_new();
+  return memo;
+}
+
+void
+og_oniguruma_memo_mark(og_SearchMemo *memo)
+{
+  rb_gc_mark(memo->snapshot);
+  rb_gc_mark(memo->string);
+}
+
+void
+og_oniguruma_memo_free(og_SearchMemo *memo)
+{
+  onig_region_free(memo->region, 1);
+  free(memo);
+}
+
+static int
+og_oniguruma_memo_valid(og_SearchMemo *memo, VALUE string)
+{
+  if (memo->string != string || RSTRING_PTR(string) != memo->ptr || RSTRING_LEN(string) != memo->length)
+    return 0;
+
+  return RSTRING_PTR(memo->snapshot) == memo->ptr ||
+    memcmp(RSTRING_PTR(memo->snapshot), memo->ptr, memo->length) == 0;
+}
+
+/*
+ * Returns non-zero and sets result, and region, if the memo answers a
+ * search of string from start up to range.
+ */
+int
+og_oniguruma_memo_lookup(og_SearchMemo *memo, VALUE string, long start, long range,
+  OnigOptionType option, OnigRegion *region, int *result)
+{
+  if (memo->ptr == NULL || !og_oniguruma_memo_valid(memo, string))
+    return 0;
+  if (range != memo->range || option != memo->option || start < memo->start)
+    return 0;
+  if (memo->result >= 0 && start > memo->result)
+    return 0;
+
+  if (memo->result >= 0)
+    onig_region_copy(region, memo->region);
+
+  *result = memo->result;
+  return 1;
+}
+
+/* Remembers the result of a search of string from start up to range */
+void
+og_oniguruma_memo_store(og_SearchMemo *memo, VALUE string, long start, long range,
+  OnigOptionType option, OnigRegion *region, int result)
+{
+  if (!og_oniguruma_memo_valid(memo, string))
+    memo->snapshot = rb_str_new4(string);
+
+  memo->string = string;
+  memo->ptr = RSTRING_PTR(string);
+  memo->length = RSTRING_LEN(string);
+  memo->start = start;
+  memo->range = range;
+  memo->option = option;
+  memo->result = result;
+
+  if (result >= 0)
+    onig_region_copy(memo->region, region);
+}
@@ -0,0 +1,408 @@
+#include "rb_oniguruma.h"
+#include "rb_oniguruma_match.h"
+
+/*
+ * Oniguruma::OMatch is a lightweight match result. It keeps the subject,
+ * one block of begin/end offsets and the regexp's shared named group table;
+ * capture strings are only created when asked for, and then cached.
+ */
+typedef struct og_omatch {
+  VALUE string;     /* frozen subject */
+  VALUE names;      /* shared { :name => group } Hash, or nil */
+  int num_regs;
+  int *offsets;     /* begin, end pairs for every group */
+  VALUE *captures;  /* Qundef until the group is first read */
+} og_OMatch;
+
+static VALUE og_cOniguruma_OMatch;
+
+static void
+og_oniguruma_omatch_mark(void *arg)
+{
+  int i;
+  og_OMatch *omatch = (og_OMatch*)arg;
+
+  rb_gc_mark(omatch->string);
+  rb_gc_mark(omatch->names);
+
+  for (i = 0; i < omatch->num_regs; i++)
+    if (omatch->captures[i] != Qundef)
+      rb_gc_mark(omatch->captures[i]);
+}
+
+static void
+og_oniguruma_omatch_free(void *arg)
+{
+  og_OMatch *omatch = (og_OMatch*)arg;
+  free(omatch->offsets);
+  free(omatch);
+}
+
+VALUE
+og_oniguruma_omatch_new(OnigRegion *region, VALUE string, VALUE names)
+{
+  int i;
+  og_OMatch *omatch;
+  VALUE obj;
+
+  /* Wrapped while empty, so the copy of string below is marked from the start */
+  omatch = malloc(sizeof(og_OMatch));
+  omatch->string = Qnil;
+  omatch->names = Qnil;
+  omatch->num_regs = 0;
+  omatch->offsets = NULL;
+  omatch->captures = NULL;
+  obj = Data_Wrap_Struct(og_cOniguruma_OMatch, og_oniguruma_omatch_mark, og_oniguruma_omatch_free, omatch);
+
+  /* Offsets and the capture cache share one allocation */
+  omatch->offsets = malloc(region->num_regs * (2 * sizeof(int) + sizeof(VALUE)));
+  omatch->captures = (VALUE*)(omatch->offsets + 2 * region->num_regs);
+
+  for (i = 0; i < region->num_regs; i++) {
+    omatch->offsets[2 * i]     = region->beg[i];
+    omatch->offsets[2 * i + 1] = region->end[i];
+    omatch->captures[i] = Qundef;
+  }
+  omatch->num_regs = region->num_regs;
+
+  omatch->names = names;
+  omatch->string = rb_str_new4(string);
+
+  return obj;
+}
+
+/* Maps an Integer, Symbol or String group reference to a group number, or -1 */
+static int
+og_oniguruma_omatch_group(og_OMatch *omatch, VALUE group)
+{
+  int n;
+  VALUE index;
+
+  if (SYMBOL_P(group) || TYPE(group) == T_STRING) {
+    if (NIL_P(omatch->names))
+      return -1;
+    if (TYPE(group) == T_STRING)
+      group = ID2SYM(rb_intern(StringValueCStr(group)));
+
+    index = rb_hash_aref(omatch->names, group);
+    return NIL_P(index) ? -1 : FIX2INT(index);
+  }
+
+  n = NUM2INT(group);
+  if (n < 0) n += omatch->num_regs;
+  if (n < 0 || n >= omatch->num_regs)
+    return -1;
+  return n;
+}
+
+static VALUE
+og_oniguruma_omatch_capture(og_OMatch *omatch, int n)
+{
+  int beg, end;
+
+  if (omatch->captures[n] == Qundef) {
+    beg = omatch->offsets[2 * n];
+    end = omatch->offsets[2 * n + 1];
+
+    if (beg < 0)
+      omatch->captures[n] = Qnil;
+    else
+      omatch->captures[n] = rb_str_substr(omatch->string, beg, end - beg);
+  }
+
+  return omatch->captures[n];
+}
+
+/*
+ * Document-method: []
+ *
+ * call-seq:
+ *    omatch[i]        => str or nil
+ *    omatch[symbol]   => str or nil
+ *
+ * Returns the string captured by group <i>i</i> or by the named group
+ * <i>symbol</i>. The string is created on first access and cached.
+ *
+ *    m = ORegexp.new('(?<first>\w+) (?<last>\w+)').omatch('Ada Lovelace')
+ *    m[:last]   #=> "Lovelace"
+ */
+static VALUE
+og_oniguruma_omatch_aref(VALUE self, VALUE group)
+{
+  int n;
+  og_OMatch *omatch;
+
+  Data_Get_Struct(self, og_OMatch, omatch);
+
+  n = og_oniguruma_omatch_group(omatch, group);
+  if (n < 0)
+    return Qnil;
+  return og_oniguruma_omatch_capture(omatch, n);
+}
+
+static VALUE
+og_oniguruma_omatch_position(int argc, VALUE *argv, VALUE self, int which)
+{
+  int n;
+  VALUE group;
+  og_OMatch *omatch;
+
+  Data_Get_Struct(self, og_OMatch, omatch);
+  rb_scan_args(argc, argv, "01", &group);
+
+  n = NIL_P(group) ? 0 : og_oniguruma_omatch_group(omatch, group);
+  if (n < 0 || omatch->offsets[2 * n] < 0)
+    return Qnil;
+
+  if (which < 0)
+    return rb_assoc_new(INT2FIX(omatch->offsets[2 * n]), INT2FIX(omatch->offsets[2 * n + 1]));
+  return INT2FIX(omatch->offsets[2 * n + which]);
+}
+
+/*
+ * Document-method: begin
+ *
+ * call-seq:
+ *    omatch.begin(n=0)   => integer or nil
+ *
+ * Returns the byte offset of the start of group <i>n</i>, which may also be
+ * a group name.
+ */
+static VALUE
+og_oniguruma_omatch_begin(int argc, VALUE *argv, VALUE self)
+{
+  return og_oniguruma_omatch_position(argc, argv, self, 0);
+}
+
+/*
+ * Document-method: end
+ *
+ * call-seq:
+ *    omatch.end(n=0)   => integer or nil
+ *
+ * Returns the byte offset following the end of group <i>n</i>, which may
+ * also be a group name.
+ */
+static VALUE
+og_oniguruma_omatch_end(int argc, VALUE *argv, VALUE self)
+{
+  return og_oniguruma_omatch_position(argc, argv, self, 1);
+}
+
+/*
+ * Document-method: offset
+ *
+ * call-seq:
+ *    omatch.offset(n=0)   => [begin, end] or nil
+ *
+ * Returns the begin and end offsets of group <i>n</i>.
+ */
+static VALUE
+og_oniguruma_omatch_offset(int argc, VALUE *argv, VALUE self)
+{
+  return og_oniguruma_omatch_position(argc, argv, self, -1);
+}
+
+/*
+ * Document-method: size
+ *
+ * call-seq:
+ *    omatch.size     => integer
+ *    omatch.length   => integer
+ *
+ * Returns the number of groups, including the whole match.
+ */
+static VALUE
+og_oniguruma_omatch_size(VALUE self)
+{
+  og_OMatch *omatch;
+
+  Data_Get_Struct(self, og_OMatch, omatch);
+  return INT2FIX(omatch->num_regs);
+}
+
+/*
+ * Document-method: to_a
+ *
+ * call-seq:
+ *    omatch.to_a   => array
+ *
+ * Returns the whole match followed by every captured group.
+ */
+static VALUE
+og_oniguruma_omatch_to_a(VALUE self)
+{
+  int i;
+  VALUE ary;
+  og_OMatch *omatch;
+
+  Data_Get_Struct(self, og_OMatch, omatch);
+
+  ary = rb_ary_new2(omatch->num_regs);
+  for (i = 0; i < omatch->num_regs; i++)
+    rb_ary_push(ary, og_oniguruma_omatch_capture(omatch, i));
+
+  return ary;
+}
+
+/*
+ * Document-method: captures
+ *
+ * call-seq:
+ *    omatch.captures   => array
+ *
+ * Returns the captured groups, without the whole match.
+ */
+static VALUE
+og_oniguruma_omatch_captures(VALUE self)
+{
+  VALUE ary = og_oniguruma_omatch_to_a(self);
+  rb_ary_shift(ary);
+  return ary;
+}
+
+/*
+ * Document-method: to_s
+ *
+ * call-seq:
+ *    omatch.to_s   => str
+ *
+ * Returns the whole matched string.
+ */
+static VALUE
+og_oniguruma_omatch_to_s(VALUE self)
+{
+  og_OMatch *omatch;
+
+  Data_Get_Struct(self, og_OMatch, omatch);
+  return og_oniguruma_omatch_capture(omatch, 0);
+}
+
+/*
+ * Document-method: pre_match
+ *
+ * call-seq:
+ *    omatch.pre_match   => str
+ *
+ * Returns the part of the subject before the match.
+ */
+static VALUE
+og_oniguruma_omatch_pre_match(VALUE self)
+{
+  og_OMatch *omatch;
+
+  Data_Get_Struct(self, og_OMatch, omatch);
+  return rb_str_substr(omatch->string, 0, omatch->offsets[0]);
+}
+
+/*
+ * Document-method: post_match
+ *
+ * call-seq:
+ *    omatch.post_match   => str
+ *
+ * Returns the part of the subject after the match.
+ */
+static VALUE
+og_oniguruma_omatch_post_match(VALUE self)
+{
+  og_OMatch *omatch;
+
+  Data_Get_Struct(self, og_OMatch, omatch);
+  return rb_str_substr(omatch->string, omatch->offsets[1],
+    RSTRING_LEN(omatch->string) - omatch->offsets[1]);
+}
+
+/*
+ * Document-method: string
+ *
+ * call-seq:
+ *    omatch.string   => str
+ *
+ * Returns the frozen subject string.
+ */
+static VALUE
+og_oniguruma_omatch_string(VALUE self)
+{
+  og_OMatch *omatch;
+
+  Data_Get_Struct(self, og_OMatch, omatch);
+  return omatch->string;
+}
+
+/*
+ * Document-method: to_match_data
+ *
+ * call-seq:
+ *    omatch.to_match_data   => matchdata
+ *
+ * Builds an equivalent <code>MatchData</code>, including named group
+ * lookups, for code which needs the real thing.
+ */
+static VALUE
+og_oniguruma_omatch_to_match_data(VALUE self)
+{
+  int i;
+  VALUE match;
+  OnigRegion *region;
+  og_OMatch *omatch;
+
+  Data_Get_Struct(self, og_OMatch, omatch);
+
+  region = onig_region_new();
+  onig_region_resize(region, omatch->num_regs);
+
+  for (i = 0; i < omatch->num_regs; i++) {
+    region->beg[i] = omatch->offsets[2 * i];
+    region->end[i] = omatch->offsets[2 * i + 1];
+  }
+
+  match = og_oniguruma_match_initialize(region, omatch->string);
+  onig_region_free(region, 1);
+
+  if (!NIL_P(omatch->names))
+    rb_iv_set(match, "@named_captures", omatch->names);
+
+  return match;
+}
+
+/*
+ * Document-method: inspect
+ *
+ * call-seq:
+ *    omatch.inspect   => str
+ */
+static VALUE
+og_oniguruma_omatch_inspect(VALUE self)
+{
+  VALUE str = rb_str_new2("#<");
+
+  rb_str_cat2(str, rb_obj_classname(self));
+  rb_str_cat2(str, " ");
+  rb_str_concat(str, rb_inspect(og_oniguruma_omatch_to_s(self)));
+  return rb_str_cat2(str, ">");
+}
+
+void
+og_oniguruma_omatch(VALUE mod)
+{
+  og_cOniguruma_OMatch = rb_define_class_under(mod, OG_C_OMATCH, rb_cObject);
+  rb_undef_alloc_func(og_cOniguruma_OMatch);
+
+  /*               Class                 Method            Handler Function                    Args */
+  rb_define_method(og_cOniguruma_OMatch, "[]",             og_oniguruma_omatch_aref,            1);
+  rb_define_method(og_cOniguruma_OMatch, "begin",          og_oniguruma_omatch_begin,          -1);
+  rb_define_method(og_cOniguruma_OMatch, "end",            og_oniguruma_omatch_end,            -1);
+  rb_define_method(og_cOniguruma_OMatch, "offset",         og_oniguruma_omatch_offset,         -1);
+  rb_define_method(og_cOniguruma_OMatch, "size",           og_oniguruma_omatch_size,            0);
+  rb_define_method(og_cOniguruma_OMatch, "to_a",           og_oniguruma_omatch_to_a,            0);
+  rb_define_method(og_cOniguruma_OMatch, "captures",       og_oniguruma_omatch_captures,        0);
+  rb_define_method(og_cOniguruma_OMatch, "to_s",           og_oniguruma_omatch_to_s,            0);
+  rb_define_method(og_cOniguruma_OMatch, "pre_match",      og_oniguruma_omatch_pre_match,       0);
+  rb_define_method(og_cOniguruma_OMatch, "post_match",     og_oniguruma_omatch_post_match,      0);
+  rb_define_method(og_cOniguruma_OMatch, "string",         og_oniguruma_omatch_string,          0);
+  rb_define_method(og_cOniguruma_OMatch, "to_match_data",  og_oniguruma_omatch_to_match_data,   0);
+  rb_define_method(og_cOniguruma_OMatch, "inspect",        og_oniguruma_omatch_inspect,         0);
+
+  rb_define_alias(og_cOniguruma_OMatch, "length", "size");
+}
@@ -1,12 +1,7 @@
 #include "rb_oniguruma.h"
 #include "rb_oniguruma_match.h"
 #include "rb_oniguruma_struct_args.h"
-
-#if ONIGURUMA_VERSION_MAJOR >= 5
-# ifndef enc_len
-#  define enc_len(enc, byte) ONIGENC_MBC_ENC_LEN(enc, byte)
-# endif
-#endif
+#include "rb_oniguruma_pool.h"
 
 #define og_oniguruma_oregexp_get_code_point(cp, cpl, enc, rep, pos) do {    \
   cp = ONIGENC_MBC_TO_CODE(enc, OG_STRING_PTR(rep) + pos,                   \
@@ -14,6 +9,11 @@
   cpl = enc_len(enc, (OG_STRING_PTR(rep) + pos));                           \
 } while(0)
 
+#define og_oniguruma_oregexp_ensure_compiled(oregexp) do {  \
+  if ((oregexp)->reg == NULL)                               \
+    og_oniguruma_oregexp_compile(oregexp);                  \
+} while(0)
+
 static inline void
 og_oniguruma_string_modification_check(VALUE s, char *p, long len)
 {
@@ -43,6 +43,15 @@ og_oniguruma_oregexp_escape(int argc, VALUE *argv, VALUE self)
   return rb_funcall3(rb_cRegexp, rb_intern("escape"), argc, argv);
 }
 
+/* Whether matches update ORegexp.last_match and $~, see track_last_match= */
+static int og_track_last_match = 1;
+
+/* Thread local key of ORegexp.last_match */
+static ID og_id_last_match;
+
+#define og_oniguruma_oregexp_tracking(oregexp) \
+  ((oregexp)->last_match < 0 ? og_track_last_match : (oregexp)->last_match)
+
 /*
  * Document-method: last_match
  *
@@ -51,8 +60,8 @@ og_oniguruma_oregexp_escape(int argc, VALUE *argv, VALUE self)
  *    ORegexp.last_match(fixnum)   => str
  *
  * The first form returns the <code>MatchData</code> object generated by the
- * last successful pattern match. The second form returns the nth field in this
- * <code>MatchData</code> object.
+ * last successful pattern match in the current thread. The second form
+ * returns the nth field in this <code>MatchData</code> object.
  *
  *    ORegexp.new( 'c(.)t' ) =~ 'cat'       #=> 0
  *    ORegexp.last_match                    #=> #<MatchData:0x401b3d30>
@@ -63,26 +72,116 @@ og_oniguruma_oregexp_escape(int argc, VALUE *argv, VALUE self)
 static VALUE
 og_oniguruma_oregexp_last_match(int argc, VALUE *argv, VALUE self)
 {
-  VALUE index, args[2];
+  VALUE index, match, args[2];
   
   rb_scan_args(argc, argv, "01", &index);
   
-  if (index == Qnil) {
-    return rb_cv_get(self, "@@last_match");
+  match = rb_thread_local_aref(rb_thread_current(), og_id_last_match);
+  
+  if (index == Qnil || match == Qnil) {
+    return match;
   } else {
     args[0] = index;
     args[1] = (VALUE)NULL;
     
-    return rb_funcall3(rb_cv_get(self, "@@last_match"), rb_intern("[]"), 1, args);
+    return rb_funcall3(match, rb_intern("[]"), 1, args);
+  }
+}
+
+/*
+ * Document-method: track_last_match=
+ *
+ * call-seq:
+ *    ORegexp.track_last_match = true or false
+ *
+ * Turns updating <code>ORegexp.last_match</code> and <code>$~</code> on or
+ * off for every ORegexp created without a <code>:last_match</code> option.
+ * Turning it off saves work in hot loops. It also clears
+ * <code>ORegexp.last_match</code> of the calling thread, so that thread no
+ * longer keeps its last <code>MatchData</code> and subject string alive;
+ * other threads keep theirs until they clear it or exit.
+ */
+static VALUE
+og_oniguruma_oregexp_set_track_last_match(VALUE self, VALUE track)
+{
+  og_track_last_match = RTEST(track);
+  
+  if (!og_track_last_match)
+    rb_thread_local_aset(rb_thread_current(), og_id_last_match, Qnil);
+  
+  return track;
+}
+
+/*
+ * Document-method: track_last_match?
+ *
+ * call-seq:
+ *    ORegexp.track_last_match?   => true or false
+ */
+static VALUE
+og_oniguruma_oregexp_track_last_match(VALUE self)
+{
+  return og_track_last_match ? Qtrue : Qfalse;
+}
+
+static void og_oniguruma_oregexp_compile(og_ORegexp *oregexp);
+
+/*
+ * Document-method: warm
+ *
+ * call-seq:
+ *    ORegexp.warm(list)   => list
+ *
+ * Compiles every lazily constructed ORegexp in <i>list</i> which has not
+ * been used yet, so the cost is paid ahead of traffic. Raises
+ * <code>ArgumentError</code> for the first pattern which fails to compile.
+ *
+ *    rules = patterns.map { |p| ORegexp.new(p, :lazy => true) }
+ *    ORegexp.warm(rules)
+ */
+static VALUE
+og_oniguruma_oregexp_warm(VALUE self, VALUE list)
+{
+  long i;
+  og_ORegexp *oregexp;
+  VALUE item;
+  
+  list = rb_Array(list);
+  
+  for (i = 0; i < RARRAY_LEN(list); i++) {
+    item = rb_ary_entry(list, i);
+    if (!rb_obj_is_kind_of(item, self))
+      rb_raise(rb_eTypeError, "wrong argument type %s (expected %s)",
+        rb_obj_classname(item), rb_class2name(self));
+    
+    Data_Get_Struct(item, og_ORegexp, oregexp);
+    og_oniguruma_oregexp_ensure_compiled(oregexp);
   }
+  
+  return list;
 }
 
 /* Constructor Methods */
+static void
+og_oniguruma_oregexp_mark(void *arg)
+{
+  og_ORegexp *oregexp = (og_ORegexp*)arg;
+  rb_gc_mark(oregexp->pattern);
+  rb_gc_mark(oregexp->names);
+  if (oregexp->memo != NULL)
+    og_oniguruma_memo_mark(oregexp->memo);
+}
+
 static void
 og_oniguruma_oregexp_free(void *arg)
 {
   og_ORegexp *oregexp = (og_ORegexp*)arg;
-  onig_free(oregexp->reg);
+  og_oniguruma_program_release(oregexp->program);
+  og_oniguruma_program_release(oregexp->bare);
+  if (oregexp->region != NULL)
+    onig_region_free(oregexp->region, 1);
+  if (oregexp->memo != NULL)
+    og_oniguruma_memo_free(oregexp->memo);
   free(oregexp);
 }
 
@@ -114,6 +213,31 @@ og_oniguruma_oregexp_free(void *arg)
  *
  * Second form uses string shortcuts to set options and encoding:
  *     r = ORegexp.new('cat', 'i', 'utf8', 'java')
+ *
+ * Passing <code>:lazy => true</code> in the options hash defers compiling
+ * the pattern until the regexp is first used; errors in the pattern are then
+ * raised by that first call (see also <code>ORegexp.warm</code>).
+ *
+ * <code>:last_match => false</code> stops matches with this regexp from
+ * updating <code>ORegexp.last_match</code> and <code>$~</code>, overriding
+ * <code>ORegexp.track_last_match=</code>.
+ *
+ * <code>:match_limit => steps</code> and <code>:timeout => secs</code> bound
+ * the work of every search, which then raises
+ * <code>Oniguruma::MatchTimeout</code> (see
+ * <code>ORegexp.default_timeout=</code> for the granularity). A trailing
+ * Hash with the same keys overrides them for one call of <code>match</code>,
+ * <code>scan</code>, <code>sub</code>, <code>gsub</code> and the predicates:
+ *
+ *     r = ORegexp.new(user_pattern, :timeout => 0.5)
+ *     r.scan(log, :timeout => 5)
+ *
+ * <code>:memo => true</code> makes the regexp remember its last search
+ * result. Searching the same, unmodified string again from a start position
+ * between the previous start and the match it found (or anywhere after the
+ * previous start, when nothing was found) then returns that result without
+ * running the engine, which is what tokenizers searching one line from
+ * increasing offsets do.
  */
 static VALUE
 og_oniguruma_oregexp_alloc(VALUE klass)
@@ -123,69 +247,200 @@ og_oniguruma_oregexp_alloc(VALUE klass)
   
   oregexp = malloc( sizeof( og_ORegexp ) );
   oregexp->reg = NULL;
-  
-  obj = Data_Wrap_Struct(klass, 0, og_oniguruma_oregexp_free, oregexp);
+  oregexp->program = NULL;
+  oregexp->bare = NULL;
+  oregexp->region = NULL;
+  oregexp->pattern = Qnil;
+  oregexp->names = Qnil;
+  oregexp->options = ONIG_OPTION_NONE;
+  oregexp->encoding = OG_ENCODING_DEFAULT;
+  oregexp->syntax = OG_SYNTAX_DEFAULT;
+  oregexp->last_match = -1;
+  oregexp->limits.match_limit = -1;
+  oregexp->limits.timeout = -1;
+  oregexp->memo = NULL;
+  
+  obj = Data_Wrap_Struct(klass, og_oniguruma_oregexp_mark, og_oniguruma_oregexp_free, oregexp);
   return obj;
 }
 
 /* Instance Methods */
-static int
-og_oniguruma_oregexp_compile(VALUE self, VALUE regex)
+/* Builds the frozen { :name => group } table, or nil without named groups */
+static VALUE
+og_oniguruma_oregexp_build_names(regex_t *reg)
+{
+  og_CallbackPacket packet;
+  
+  if (onig_number_of_names(reg) == 0)
+    return Qnil;
+  
+  packet.hash = rb_hash_new();
+  packet.region = NULL;
+  onig_foreach_name(reg, &og_oniguruma_name_callback, &packet);
+  
+  return rb_obj_freeze(packet.hash);
+}
+
+static void
+og_oniguruma_oregexp_set_program(og_ORegexp *oregexp, og_Program *program)
+{
+  og_oniguruma_program_release(oregexp->program);
+  oregexp->program = program;
+  oregexp->reg = program->reg;
+  oregexp->names = og_oniguruma_oregexp_build_names(program->reg);
+}
+
+static void
+og_oniguruma_oregexp_compile(og_ORegexp *oregexp)
 {
   int result;
-  og_ORegexp *oregexp;
+  og_Program *program;
   OnigErrorInfo error_info;
   UChar error_string[ONIG_MAX_ERROR_MESSAGE_LEN];
   
-  Data_Get_Struct(self, og_ORegexp, oregexp);
-  StringValue(regex);
-  
-  result = onig_new(&(oregexp->reg),    /* Regexp Object */
-    OG_STRING_PTR(regex), OG_STRING_PTR(regex) + RSTRING_LEN(regex),
-    og_oniguruma_extract_option(rb_iv_get(self, "@options")),
-    og_oniguruma_extract_encoding(rb_iv_get(self, "@encoding")),
-    og_oniguruma_extract_syntax(rb_iv_get(self, "@syntax")),
-    &error_info);
+  /* Equal patterns share one compiled program through the cache */
+  result = og_oniguruma_program_fetch(&program, &oregexp->key, &error_info);
   
   if (result != ONIG_NORMAL) {
     onig_error_code_to_str(error_string, result, &error_info);
     rb_raise(rb_eArgError, "Oniguruma Error: %s", error_string);
   }
   
-  return Qnil;
+  og_oniguruma_oregexp_set_program(oregexp, program);
+}
+
+/* Returns the compiled program, compiling a lazy ORegexp on first use */
+regex_t*
+og_oniguruma_oregexp_reg(VALUE self)
+{
+  og_ORegexp *oregexp;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  og_oniguruma_oregexp_ensure_compiled(oregexp);
+  
+  return oregexp->reg;
+}
+
+/*
+ * Each ORegexp keeps one spare region, so repeated matches reuse the
+ * region and its register arrays instead of allocating new ones.
+ */
+static OnigRegion*
+og_oniguruma_oregexp_region_acquire(og_ORegexp *oregexp)
+{
+  OnigRegion *region = oregexp->region;
+  
+  if (region == NULL)
+    return onig_region_new();
+  
+  oregexp->region = NULL;
+  return region;
 }
 
 static void
-og_oniguruma_oregexp_options_parse(VALUE self, VALUE hash)
+og_oniguruma_oregexp_region_release(og_ORegexp *oregexp, OnigRegion *region)
 {
-  VALUE options, encoding, syntax, og_mOniguruma;
+  if (oregexp->region == NULL)
+    oregexp->region = region;
+  else
+    onig_region_free(region, 1);
+}
+
+static int
+og_oniguruma_oregexp_search(og_ORegexp *oregexp, VALUE string, long start, long range,
+  OnigRegion *region, OnigOptionType option, const og_SearchLimits *limits)
+{
+  int result;
   
-  og_mOniguruma = rb_const_get(rb_cObject, rb_intern(OG_M_ONIGURUMA));
+  og_oniguruma_oregexp_ensure_compiled(oregexp);
+  
+  /* The memo can't answer for \G, and needs a region to answer with */
+  if (oregexp->memo == NULL || region == NULL || range < start || oregexp->program->start_dependent)
+    return og_oniguruma_search_string(oregexp->program, string, start, range, region, option, limits);
+  
+  if (og_oniguruma_memo_lookup(oregexp->memo, string, start, range, option, region, &result))
+    return result;
+  
+  result = og_oniguruma_search_string(oregexp->program, string, start, range, region, option, limits);
+  
+  if (result >= 0 || result == ONIG_MISMATCH)
+    og_oniguruma_memo_store(oregexp->memo, string, start, range, option, region, result);
+  
+  return result;
+}
+
+/*
+ * Takes the limits of oregexp, overridden by a trailing { :match_limit,
+ * :timeout } Hash which is then removed from the arguments. Only a Hash at
+ * argument hash_from or later is taken, so one passed where the method
+ * expects another argument still fails as that argument.
+ */
+static void
+og_oniguruma_oregexp_call_limits(og_ORegexp *oregexp, int *argc, VALUE *argv, int hash_from,
+  og_SearchLimits *limits)
+{
+  *limits = oregexp->limits;
+  
+  if (*argc > hash_from && TYPE(argv[*argc - 1]) == T_HASH) {
+    (*argc)--;
+    og_oniguruma_search_limits_parse(limits, argv[*argc]);
+  }
+}
+
+static void
+og_oniguruma_oregexp_options_parse(og_ORegexp *oregexp, VALUE hash)
+{
+  VALUE options, encoding, syntax, last_match, memo;
+  
+  encoding   = rb_hash_aref(hash, ID2SYM(rb_intern("encoding")));
+  options    = rb_hash_aref(hash, ID2SYM(rb_intern("options")));
+  syntax     = rb_hash_aref(hash, ID2SYM(rb_intern("syntax")));
+  last_match = rb_hash_aref(hash, ID2SYM(rb_intern("last_match")));
+  memo       = rb_hash_aref(hash, ID2SYM(rb_intern("memo")));
+  
+  oregexp->encoding   = NIL_P(encoding)   ? OG_ENCODING_DEFAULT : FIX2INT(encoding);
+  oregexp->options    = NIL_P(options)    ? ONIG_OPTION_NONE : og_oniguruma_extract_option(options);
+  oregexp->syntax     = NIL_P(syntax)     ? OG_SYNTAX_DEFAULT : FIX2INT(syntax);
+  oregexp->last_match = NIL_P(last_match) ? -1 : RTEST(last_match);
   
-  encoding = rb_hash_aref(hash, ID2SYM(rb_intern("encoding")));
-  options  = rb_hash_aref(hash, ID2SYM(rb_intern("options")));
-  syntax   = rb_hash_aref(hash, ID2SYM(rb_intern("syntax")));
+  og_oniguruma_search_limits_parse(&oregexp->limits, hash);
   
-  if (NIL_P(encoding))
-    encoding = rb_const_get(og_mOniguruma, rb_intern("ENCODING_ASCII"));
+  if (RTEST(memo) && oregexp->memo == NULL)
+    oregexp->memo = og_oniguruma_memo_new();
+}
+
+/* Sets up everything but the compiled program, returns true for :lazy */
+static int
+og_oniguruma_oregexp_setup(VALUE self, VALUE re, VALUE options)
+{
+  VALUE lazy;
+  og_ORegexp *oregexp;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
   
-  if (NIL_P(options))
-    options = rb_const_get(og_mOniguruma, rb_intern("OPTION_DEFAULT"));
+  oregexp->pattern = rb_str_new4(StringValue(re)); /* Take a frozen copy */
+  og_oniguruma_oregexp_options_parse(oregexp, options);
+  lazy = rb_hash_aref(options, ID2SYM(rb_intern("lazy")));
   
-  if (NIL_P(syntax))
-    syntax = rb_const_get(og_mOniguruma, rb_intern("SYNTAX_DEFAULT"));
+  og_oniguruma_pattern_key_set(&oregexp->key,
+    OG_STRING_PTR(oregexp->pattern), RSTRING_LEN(oregexp->pattern),
+    oregexp->options,
+    og_oniguruma_extract_encoding(INT2FIX(oregexp->encoding)),
+    og_oniguruma_extract_syntax(INT2FIX(oregexp->syntax)));
   
-  rb_iv_set(self, "@encoding", encoding);
-  rb_iv_set(self, "@options", options);
-  rb_iv_set(self, "@syntax", syntax);
+  return RTEST(lazy);
 }
 
 static VALUE
 og_oniguruma_oregexp_initialize_real(VALUE self, VALUE re, VALUE options)
 {
-  rb_iv_set(self, "@pattern", StringValue(re)); /* Take a copy */
-  og_oniguruma_oregexp_options_parse(self, options);
-  og_oniguruma_oregexp_compile(self, rb_iv_get(self, "@pattern"));
+  og_ORegexp *oregexp;
+  
+  /* Lazy regexps compile, and report errors, on first use */
+  if (!og_oniguruma_oregexp_setup(self, re, options)) {
+    Data_Get_Struct(self, og_ORegexp, oregexp);
+    og_oniguruma_oregexp_compile(oregexp);
+  }
   
   return self;
 }
@@ -201,18 +456,19 @@ og_oniguruma_oregexp_upper(char *str)
   }
 }
 
+/* Parses ORegexp.new arguments into the pattern and an options hash */
 static VALUE
-og_oniguruma_oregexp_initialize(int argc, VALUE *argv, VALUE self)
+og_oniguruma_oregexp_parse_arguments(int argc, VALUE *argv, VALUE *re)
 {
   int i;
   long opts;
   char *byte;
-  VALUE re, args, options, shortcuts,
+  VALUE args, options, shortcuts,
     cut, opt, enc, syn, og_mOniguruma;
 
   og_mOniguruma = rb_const_get(rb_cObject, rb_intern(OG_M_ONIGURUMA));
   
-  rb_scan_args(argc, argv, "1*", &re, &args);
+  rb_scan_args(argc, argv, "1*", re, &args);
   
   if (TYPE(rb_ary_entry(args, 0)) == T_STRING) {
     options = rb_hash_new();
@@ -263,29 +519,262 @@ og_oniguruma_oregexp_initialize(int argc, VALUE *argv, VALUE self)
       options = rb_hash_new();
   }
   
+  return options;
+}
+
+static VALUE
+og_oniguruma_oregexp_initialize(int argc, VALUE *argv, VALUE self)
+{
+  VALUE re, options;
+  
+  options = og_oniguruma_oregexp_parse_arguments(argc, argv, &re);
   return og_oniguruma_oregexp_initialize_real(self, re, options);
 }
 
+typedef struct og_compile_job {
+  const og_PatternKey *key;
+  regex_t *reg;
+  int result;
+  OnigErrorInfo error_info;
+  og_Program *program;      /* NULL if the pattern failed to compile */
+} og_CompileJob;
+
+typedef struct og_compile_batch {
+  og_CompileJob *jobs;
+  long count;
+  int threads;
+} og_CompileBatch;
+
+static void
+og_oniguruma_oregexp_compile_task(void *context, long index)
+{
+  og_CompileJob *job = ((og_CompileBatch*)context)->jobs + index;
+  
+  job->result = onig_new(&job->reg,
+    (UChar*)job->key->pattern, (UChar*)job->key->pattern + job->key->length,
+    job->key->options, job->key->encoding, job->key->syntax,
+    &job->error_info);
+}
+
+#define OG_COMPILE_WARM_MAX 64   /* more than there are encodings */
+
+/*
+ * Oniguruma builds its case fold and property name tables on first use,
+ * unguarded unless the library was built with USE_MULTI_THREAD_SYSTEM.
+ * Compiling a case-insensitive pattern using a property in every encoding
+ * of the batch builds them here, with the interpreter lock held, rather
+ * than on several pool threads at once.
+ */
+static void
+og_oniguruma_oregexp_compile_warm(og_CompileBatch *batch)
+{
+  static const UChar pattern[] = "a[b]\\p{Alpha}";
+  long i;
+  int j, seen = 0;
+  regex_t *reg;
+  OnigErrorInfo error_info;
+  OnigEncoding encoding, warmed[OG_COMPILE_WARM_MAX];
+  
+  for (i = 0; i < batch->count && seen < OG_COMPILE_WARM_MAX; i++) {
+    encoding = batch->jobs[i].key->encoding;
+    for (j = 0; j < seen; j++)
+      if (warmed[j] == encoding)
+        break;
+    if (j < seen)
+      continue;
+    warmed[seen++] = encoding;
+    
+    if (onig_new(&reg, pattern, pattern + sizeof(pattern) - 1, ONIG_OPTION_IGNORECASE,
+          encoding, ONIG_SYNTAX_RUBY, &error_info) == ONIG_NORMAL)
+      onig_free(reg);
+  }
+}
+
+static void*
+og_oniguruma_oregexp_compile_batch(void *arg)
+{
+  og_CompileBatch *batch = (og_CompileBatch*)arg;
+  
+  og_oniguruma_pool_run(og_oniguruma_oregexp_compile_task, batch,
+    batch->count, batch->threads, NULL);
+  
+  return NULL;
+}
+
+/*
+ * Document-method: compile_all
+ *
+ * call-seq:
+ *    ORegexp.compile_all(specs, threads=nil)                           => array
+ *    ORegexp.compile_all(specs, threads=nil) {|index, message| ... }   => array
+ *
+ * Builds one ORegexp for each entry of <i>specs</i>, which are either
+ * pattern strings or arrays of <code>ORegexp.new</code> arguments, and
+ * returns them in the same order. Patterns which are not in the pattern
+ * cache are compiled on up to <i>threads</i> native threads (one per
+ * processor by default) with the interpreter lock released.
+ *
+ * Without a block an <code>ArgumentError</code> listing every pattern which
+ * failed to compile is raised. With a block, the index and error message of
+ * each failed pattern are yielded instead and its slot in the result is
+ * <code>nil</code>.
+ *
+ *    rules = ORegexp.compile_all(['\d+', ['cat', 'i'], ['dog', {:syntax => SYNTAX_JAVA}]])
+ */
+static VALUE
+og_oniguruma_oregexp_compile_all(int argc, VALUE *argv, VALUE self)
+{
+  long i, j, count, pending = 0, slot, mask;
+  long *owners, *slots;
+  int threads;
+  VALUE specs, nthreads, spec, re, options, obj, objects, errors, messages;
+  og_ORegexp *oregexp;
+  og_Program *program;
+  og_CompileJob *jobs;
+  og_CompileBatch batch;
+  UChar error_string[ONIG_MAX_ERROR_MESSAGE_LEN];
+  
+  rb_scan_args(argc, argv, "11", &specs, &nthreads);
+  
+  specs = rb_Array(specs);
+  count = RARRAY_LEN(specs);
+  threads = NIL_P(nthreads) ? og_oniguruma_pool_default_threads() : NUM2INT(nthreads);
+  if (threads < 1) threads = 1;
+  
+  objects = rb_ary_new2(count);
+  errors = rb_ary_new();
+  
+  /* Build every object without compiling; hits come straight from the cache */
+  for (i = 0; i < count; i++) {
+    spec = rb_ary_entry(specs, i);
+    if (TYPE(spec) == T_ARRAY)
+      options = og_oniguruma_oregexp_parse_arguments(RARRAY_LEN(spec), RARRAY_PTR(spec), &re);
+    else
+      options = og_oniguruma_oregexp_parse_arguments(1, &spec, &re);
+    
+    obj = og_oniguruma_oregexp_alloc(self);
+    og_oniguruma_oregexp_setup(obj, re, options);
+    rb_ary_push(objects, obj);
+    
+    Data_Get_Struct(obj, og_ORegexp, oregexp);
+    program = og_oniguruma_cache_lookup(&oregexp->key);
+    if (program != NULL)
+      og_oniguruma_oregexp_set_program(oregexp, program);
+    else
+      pending++;
+  }
+  
+  if (pending == 0)
+    return objects;
+  
+  /* Compile each distinct missing pattern once, finding duplicates by key hash */
+  mask = 16;
+  while (mask < 2 * pending)
+    mask <<= 1;
+  slots = ALLOC_N(long, mask);
+  mask--;
+  for (slot = 0; slot <= mask; slot++)
+    slots[slot] = -1;
+  
+  owners = ALLOC_N(long, count);
+  jobs = ALLOC_N(og_CompileJob, pending);
+  batch.jobs = jobs;
+  batch.count = 0;
+  batch.threads = threads;
+  
+  for (i = 0; i < count; i++) {
+    owners[i] = -1;
+    Data_Get_Struct(rb_ary_entry(objects, i), og_ORegexp, oregexp);
+    if (oregexp->reg != NULL)
+      continue;
+    
+    for (slot = oregexp->key.hash & mask; (j = slots[slot]) >= 0; slot = (slot + 1) & mask)
+      if (og_oniguruma_pattern_key_equal(jobs[j].key, &oregexp->key))
+        break;
+    
+    if (j < 0) {
+      j = slots[slot] = batch.count++;
+      jobs[j].key = &oregexp->key;
+      jobs[j].reg = NULL;
+    }
+    owners[i] = j;
+  }
+  
+  xfree(slots);
+  
+  onig_init();
+  og_oniguruma_oregexp_compile_warm(&batch);
+  og_oniguruma_without_gvl(og_oniguruma_oregexp_compile_batch, &batch, NULL, NULL);
+  
+  messages = rb_ary_new2(batch.count);
+  for (j = 0; j < batch.count; j++) {
+    jobs[j].program = NULL;
+    if (jobs[j].result == ONIG_NORMAL) {
+      jobs[j].program = og_oniguruma_program_new(jobs[j].reg, jobs[j].key);
+    } else {
+      onig_error_code_to_str(error_string, jobs[j].result, &jobs[j].error_info);
+      rb_ary_store(messages, j, rb_str_new2((char*)error_string));
+    }
+  }
+  
+  /* Hand the programs out in one pass, sharing duplicates, and collect failures */
+  for (i = 0; i < count; i++) {
+    if (owners[i] < 0)
+      continue;
+    
+    j = owners[i];
+    if (jobs[j].program != NULL) {
+      Data_Get_Struct(rb_ary_entry(objects, i), og_ORegexp, oregexp);
+      jobs[j].program->refcount++;
+      og_oniguruma_oregexp_set_program(oregexp, jobs[j].program);
+    } else {
+      rb_ary_push(errors, rb_assoc_new(LONG2NUM(i), rb_ary_entry(messages, j)));
+      rb_ary_store(objects, i, Qnil);
+    }
+  }
+  
+  for (j = 0; j < batch.count; j++)
+    og_oniguruma_program_release(jobs[j].program);
+  
+  xfree(owners);
+  xfree(jobs);
+  
+  if (RARRAY_LEN(errors) > 0) {
+    if (!rb_block_given_p()) {
+      VALUE message = rb_str_new2("");
+      for (i = 0; i < RARRAY_LEN(errors); i++) {
+        if (i > 0) rb_str_cat2(message, ", ");
+        rb_str_concat(message, rb_inspect(rb_ary_entry(rb_ary_entry(errors, i), 0)));
+        rb_str_cat2(message, ": ");
+        rb_str_concat(message, rb_ary_entry(rb_ary_entry(errors, i), 1));
+      }
+      rb_raise(rb_eArgError, "Oniguruma Error: %s", RSTRING_PTR(message));
+    }
+    
+    for (i = 0; i < RARRAY_LEN(errors); i++)
+      rb_yield_values(2, rb_ary_entry(rb_ary_entry(errors, i), 0),
+        rb_ary_entry(rb_ary_entry(errors, i), 1));
+  }
+  
+  return objects;
+}
+
 static VALUE
 og_oniguruma_oregexp_do_match(VALUE self, OnigRegion *region, VALUE string)
 {
   VALUE match;
-  og_CallbackPacket packet;
   og_ORegexp *oregexp;
   
   Data_Get_Struct(self, og_ORegexp, oregexp);
   
   match = og_oniguruma_match_initialize(region, string);
   
-  rb_cv_set(CLASS_OF(self), "@@last_match", match);
+  if (og_oniguruma_oregexp_tracking(oregexp))
+    rb_thread_local_aset(rb_thread_current(), og_id_last_match, match);
   
-  packet.region = region;
-  
-  if (onig_number_of_names(oregexp->reg) > 0) {
-    packet.hash = rb_hash_new();
-    onig_foreach_name(oregexp->reg, &og_oniguruma_name_callback, &packet);
-    rb_iv_set(match, "@named_captures", packet.hash);
-  }
+  /* Every MatchData shares the table built when the pattern was compiled */
+  if (!NIL_P(oregexp->names))
+    rb_iv_set(match, "@named_captures", oregexp->names);
   
   return match;
 }
@@ -294,8 +783,8 @@ og_oniguruma_oregexp_do_match(VALUE self, OnigRegion *region, VALUE string)
  * Document-method: match
  *
  * call-seq:
- *    rxp.match(str)               => matchdata or nil
- *    rxp.match(str, begin, end)   => matchdata or nil
+ *    rxp.match(str, options_hash=nil)               => matchdata or nil
+ *    rxp.match(str, begin, end, options_hash=nil)   => matchdata or nil
  *
  * Returns a <code>MatchData</code> object describing the match, or
  * <code>nil</code> if there was no match. This is equivalent to retrieving the
@@ -320,47 +809,238 @@ og_oniguruma_oregexp_match(int argc, VALUE *argv, VALUE self)
   int result;
   OnigRegion *region;
   og_ORegexp *oregexp;
-  
-  UChar error_string[ONIG_MAX_ERROR_MESSAGE_LEN];
+  og_SearchLimits limits;
   
   VALUE string, begin, end, match;
   
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  og_oniguruma_oregexp_call_limits(oregexp, &argc, argv, 1, &limits);
+  
   rb_scan_args(argc, argv, "12", &string, &begin, &end);
   
   if (NIL_P(begin)) begin = INT2FIX(0);
   if (NIL_P(end))   end   = INT2FIX(RSTRING_LEN(string));
   
-  Data_Get_Struct(self, og_ORegexp, oregexp);
-  
   StringValue(string);
   
-  region = onig_region_new();
-  result = onig_search(oregexp->reg,
-    OG_STRING_PTR(string),  OG_STRING_PTR(string) + RSTRING_LEN(string),
-    OG_STRING_PTR(string) + FIX2INT(begin),  OG_STRING_PTR(string) + FIX2INT(end),
-    region, ONIG_OPTION_NONE);
+  og_oniguruma_oregexp_ensure_compiled(oregexp);
+  
+  region = og_oniguruma_oregexp_region_acquire(oregexp);
+  result = og_oniguruma_oregexp_search(oregexp, string,
+    FIX2INT(begin), FIX2INT(end), region, ONIG_OPTION_NONE, &limits);
+  
+  if (og_oniguruma_oregexp_tracking(oregexp))
+    rb_backref_set(Qnil);
   
-  rb_backref_set(Qnil);
   if (result >= 0) {
     match = og_oniguruma_oregexp_do_match(self, region, string);
     
-    onig_region_free(region, 1);
-    rb_backref_set(match);
-    rb_match_busy(match);
+    og_oniguruma_oregexp_region_release(oregexp, region);
+    if (og_oniguruma_oregexp_tracking(oregexp)) {
+      rb_backref_set(match);
+      rb_match_busy(match);
+    }
     
     return match;
   } else if (result == ONIG_MISMATCH) {
-    onig_region_free(region, 1);
+    og_oniguruma_oregexp_region_release(oregexp, region);
   } else {
-    onig_region_free(region, 1);
-    
-    onig_error_code_to_str(error_string, result);
-    rb_raise(rb_eArgError, OG_M_ONIGURUMA " Error: %s", error_string);
+    og_oniguruma_oregexp_region_release(oregexp, region);
+    og_oniguruma_search_error(result);
   }
   
   return Qnil;
 }
 
+/*
+ * Document-method: omatch
+ *
+ * call-seq:
+ *    rxp.omatch(str, options_hash=nil)               => omatch or nil
+ *    rxp.omatch(str, begin, end, options_hash=nil)   => omatch or nil
+ *
+ * Like <code>match</code>, but returns a lightweight
+ * <code>Oniguruma::OMatch</code> which only keeps the subject and the group
+ * offsets, creating capture strings when they are read. Neither
+ * <code>$~</code> nor <code>ORegexp.last_match</code> are set.
+ *
+ *    m = ORegexp.new('(\d+)-(\d+)').omatch('call 555-1234')
+ *    m.offset(2)   #=> [9, 13]
+ *    m[1]          #=> "555"
+ */
+static VALUE
+og_oniguruma_oregexp_omatch(int argc, VALUE *argv, VALUE self)
+{
+  int result;
+  OnigRegion *region;
+  og_ORegexp *oregexp;
+  og_SearchLimits limits;
+  
+  VALUE string, begin, end, omatch;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  og_oniguruma_oregexp_call_limits(oregexp, &argc, argv, 1, &limits);
+  
+  rb_scan_args(argc, argv, "12", &string, &begin, &end);
+  
+  StringValue(string);
+  
+  if (NIL_P(begin)) begin = INT2FIX(0);
+  if (NIL_P(end))   end   = INT2FIX(RSTRING_LEN(string));
+  
+  og_oniguruma_oregexp_ensure_compiled(oregexp);
+  
+  region = og_oniguruma_oregexp_region_acquire(oregexp);
+  result = og_oniguruma_oregexp_search(oregexp, string,
+    FIX2INT(begin), FIX2INT(end), region, ONIG_OPTION_NONE, &limits);
+  
+  if (result >= 0) {
+    omatch = og_oniguruma_omatch_new(region, string, oregexp->names);
+    og_oniguruma_oregexp_region_release(oregexp, region);
+    return omatch;
+  }
+  
+  og_oniguruma_oregexp_region_release(oregexp, region);
+  
+  if (result != ONIG_MISMATCH)
+    og_oniguruma_search_error(result);
+  
+  return Qnil;
+}
+
+/*
+ * Returns the program used by the predicates: the pattern compiled with
+ * ONIG_OPTION_DONT_CAPTURE_GROUP, so the engine records no groups, or the
+ * regular program when that does not compile (back references, or options
+ * which cannot be combined with it).
+ */
+static og_Program*
+og_oniguruma_oregexp_bare_program(og_ORegexp *oregexp)
+{
+  og_PatternKey key;
+  og_Program *program;
+  OnigErrorInfo error_info;
+  
+  if (oregexp->bare != NULL)
+    return oregexp->bare;
+  
+  og_oniguruma_oregexp_ensure_compiled(oregexp);
+  
+  if (onig_number_of_captures(oregexp->reg) > 0) {
+    og_oniguruma_pattern_key_set(&key, oregexp->key.pattern, oregexp->key.length,
+      oregexp->key.options | ONIG_OPTION_DONT_CAPTURE_GROUP,
+      oregexp->key.encoding, oregexp->key.syntax);
+  
+    if (og_oniguruma_program_fetch(&program, &key, &error_info) == ONIG_NORMAL) {
+      oregexp->bare = program;
+      return program;
+    }
+  }
+  
+  oregexp->bare = oregexp->program;
+  oregexp->bare->refcount++;
+  return oregexp->bare;
+}
+
+/*
+ * Searches (or, when anchored, matches at pos) without a region and without
+ * touching $~ or ORegexp.last_match. Returns the match position, or
+ * ONIG_MISMATCH.
+ */
+static long
+og_oniguruma_oregexp_predicate(int argc, VALUE *argv, VALUE self, int anchored)
+{
+  long start, length;
+  int result;
+  og_Program *program;
+  og_ORegexp *oregexp;
+  og_SearchLimits limits;
+  
+  VALUE string, pos;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  og_oniguruma_oregexp_call_limits(oregexp, &argc, argv, 1, &limits);
+  
+  rb_scan_args(argc, argv, "11", &string, &pos);
+  
+  StringValue(string);
+  
+  length = RSTRING_LEN(string);
+  start = NIL_P(pos) ? 0 : NUM2LONG(pos);
+  if (start < 0) start += length;
+  if (start < 0 || start > length)
+    return ONIG_MISMATCH;
+  
+  program = og_oniguruma_oregexp_bare_program(oregexp);
+  
+  /* A range ending at start tries start alone, under the same limits */
+  result = og_oniguruma_search_string(program, string, start, anchored ? start : length,
+    NULL, ONIG_OPTION_NONE, &limits);
+  
+  if (result < 0 && result != ONIG_MISMATCH)
+    og_oniguruma_search_error(result);
+  
+  return result;
+}
+
+/*
+ * Document-method: match?
+ *
+ * call-seq:
+ *    rxp.match?(str, pos=0, options_hash=nil)   => true or false
+ *
+ * Returns whether <i>rxp</i> matches <i>str</i> at or after byte
+ * <i>pos</i>. Unlike <code>match</code> and <code>=~</code> it creates no
+ * <code>MatchData</code> and sets neither <code>$~</code> nor
+ * <code>ORegexp.last_match</code>.
+ *
+ *    ORegexp.new('b+').match?('abba')      #=> true
+ *    ORegexp.new('b+').match?('abba', 3)   #=> false
+ */
+static VALUE
+og_oniguruma_oregexp_match_p(int argc, VALUE *argv, VALUE self)
+{
+  return og_oniguruma_oregexp_predicate(argc, argv, self, 0) >= 0 ? Qtrue : Qfalse;
+}
+
+/*
+ * Document-method: index
+ *
+ * call-seq:
+ *    rxp.index(str, pos=0, options_hash=nil)   => integer or nil
+ *
+ * Returns the byte offset of the first match in <i>str</i> at or after
+ * <i>pos</i>, or <code>nil</code>. Like <code>match?</code>, it has no side
+ * effects on <code>$~</code>.
+ *
+ *    ORegexp.new('b+').index('abba')   #=> 1
+ */
+static VALUE
+og_oniguruma_oregexp_index(int argc, VALUE *argv, VALUE self)
+{
+  long position = og_oniguruma_oregexp_predicate(argc, argv, self, 0);
+  return position >= 0 ? LONG2NUM(position) : Qnil;
+}
+
+/*
+ * Document-method: start_with?
+ *
+ * call-seq:
+ *    rxp.start_with?(str, pos=0, options_hash=nil)   => true or false
+ *
+ * Returns whether <i>rxp</i> matches <i>str</i> exactly at byte
+ * <i>pos</i>, without searching further. Like <code>match?</code>, it has
+ * no side effects on <code>$~</code>.
+ *
+ *    ORegexp.new('b+').start_with?('abba')      #=> false
+ *    ORegexp.new('b+').start_with?('abba', 1)   #=> true
+ */
+static VALUE
+og_oniguruma_oregexp_start_with_p(int argc, VALUE *argv, VALUE self)
+{
+  return og_oniguruma_oregexp_predicate(argc, argv, self, 1) >= 0 ? Qtrue : Qfalse;
+}
+
 static VALUE
 og_oniguruma_oregexp_do_replacement(VALUE self, VALUE buffer, VALUE str, VALUE replacement, OnigRegion *region)
 {
@@ -535,10 +1215,11 @@ og_oniguruma_oregexp_do_substitution(og_SubstitutionArgs *args)
   Data_Get_Struct(args->self, og_ORegexp, oregexp);
   subj = OG_STRING_PTR(str); subj_len = RSTRING_LEN(str);
   
-  begin = onig_search(oregexp->reg,
-    subj, subj + subj_len,
-    subj, subj + subj_len,
-    args->region, ONIG_OPTION_NONE);
+  begin = og_oniguruma_oregexp_search(oregexp, str,
+    0, subj_len, args->region, ONIG_OPTION_NONE, &args->limits);
+  
+  if (begin < 0 && begin != ONIG_MISMATCH)
+    og_oniguruma_search_error(begin);
   
   if (begin < 0) {
     if (args->update_self)
@@ -560,8 +1241,10 @@ og_oniguruma_oregexp_do_substitution(og_SubstitutionArgs *args)
       /* yielding to a block */
       block_match = og_oniguruma_oregexp_do_match(args->self, args->region, str);
       
-      rb_backref_set(block_match);
-      rb_match_busy(block_match);
+      if (og_oniguruma_oregexp_tracking(oregexp)) {
+        rb_backref_set(block_match);
+        rb_match_busy(block_match);
+      }
       
       block_result = rb_yield(block_match);
       
@@ -578,56 +1261,217 @@ og_oniguruma_oregexp_do_substitution(og_SubstitutionArgs *args)
     if (begin == end) {
       if (subj_len <= end) break;
       
-      multibyte_diff = enc_len(encoding, (subj + end));
-      rb_str_buf_cat(buffer, (char*)(subj + end), multibyte_diff);
-      end += multibyte_diff;
+      multibyte_diff = enc_len(encoding, (subj + end));
+      rb_str_buf_cat(buffer, (char*)(subj + end), multibyte_diff);
+      end += multibyte_diff;
+    }
+    
+    begin = og_oniguruma_oregexp_search(oregexp, str,
+      end, subj_len, args->region, ONIG_OPTION_NONE, &args->limits);
+  } while (begin >= 0);
+  
+  if (begin != ONIG_MISMATCH)
+    og_oniguruma_search_error(begin);
+  
+  rb_str_buf_cat(buffer, (char*)(subj + end), subj_len - end);
+  
+  if (tainted_replacement)
+    OBJ_INFECT(buffer, replacement);
+  OBJ_INFECT(buffer, str);
+  
+  if (args->update_self) {
+    rb_funcall(str, rb_intern("replace"), 1, buffer);
+    return str;
+  }
+  
+  return buffer;
+}
+
+static VALUE
+og_oniguruma_oregexp_do_cleanup(VALUE self, OnigRegion *region)
+{
+  og_ORegexp *oregexp;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  og_oniguruma_oregexp_region_release(oregexp, region);
+  return Qnil;
+}
+
+/* Result modes of match_many */
+#define OG_MATCH_MANY_BOOL      0
+#define OG_MATCH_MANY_OFFSETS   1
+#define OG_MATCH_MANY_CAPTURES  2
+
+static VALUE
+og_oniguruma_oregexp_do_match_many(og_MatchManyArgs *args)
+{
+  long i, n;
+  int result, group;
+  int offsets[2];
+  og_Program *program;
+  og_ORegexp *oregexp;
+  OnigRegion *region;
+  VALUE subject, captures, results;
+  
+  Data_Get_Struct(args->self, og_ORegexp, oregexp);
+  
+  /* Only captures need the groups */
+  program = og_oniguruma_oregexp_bare_program(oregexp);
+  if (args->mode == OG_MATCH_MANY_CAPTURES)
+    program = oregexp->program;
+  region = args->mode == OG_MATCH_MANY_BOOL ? NULL : args->region;
+  
+  n = RARRAY_LEN(args->subjects);
+  if (args->mode == OG_MATCH_MANY_OFFSETS)
+    results = rb_str_buf_new(n * sizeof(offsets));
+  else
+    results = rb_ary_new2(n);
+  
+  /* The Array may change size when a to_str conversion modifies it */
+  for (i = 0; i < RARRAY_LEN(args->subjects); i++) {
+    subject = rb_ary_entry(args->subjects, i);
+    StringValue(subject);
+    
+    result = og_oniguruma_search_string(program, subject, 0, RSTRING_LEN(subject),
+      region, ONIG_OPTION_NONE, &args->limits);
+    
+    if (result < 0 && result != ONIG_MISMATCH)
+      og_oniguruma_search_error(result);
+    
+    switch (args->mode) {
+    case OG_MATCH_MANY_BOOL:
+      rb_ary_push(results, result >= 0 ? Qtrue : Qfalse);
+      break;
+    
+    case OG_MATCH_MANY_OFFSETS:
+      offsets[0] = result >= 0 ? result : -1;
+      offsets[1] = result >= 0 ? region->end[0] : -1;
+      rb_str_buf_cat(results, (const char*)offsets, sizeof(offsets));
+      break;
+    
+    default:
+      if (result < 0) {
+        rb_ary_push(results, Qnil);
+        break;
+      }
+      
+      captures = rb_ary_new2(region->num_regs);
+      for (group = 0; group < region->num_regs; group++) {
+        if (region->beg[group] < 0)
+          rb_ary_push(captures, Qnil);
+        else
+          rb_ary_push(captures, rb_str_substr(subject, region->beg[group],
+            region->end[group] - region->beg[group]));
+      }
+      rb_ary_push(results, captures);
     }
-    
-    begin = onig_search(oregexp->reg,
-      subj,       subj + subj_len,
-      subj + end, subj + subj_len,
-      args->region, ONIG_OPTION_NONE);
-  } while (begin >= 0);
+  }
   
-  rb_str_buf_cat(buffer, (char*)(subj + end), subj_len - end);
+  return results;
+}
+
+static VALUE
+og_oniguruma_oregexp_do_match_many_cleanup(og_MatchManyArgs *args)
+{
+  return og_oniguruma_oregexp_do_cleanup(args->self, args->region);
+}
+
+/*
+ * Document-method: match_many
+ *
+ * call-seq:
+ *    rxp.match_many(array, options_hash=nil)   => array or string
+ *
+ * Searches every String of <i>array</i> in one call, reusing a single
+ * region, and returns one result per element according to
+ * <code>:mode</code>:
+ *
+ * <code>:bool</code>::      (the default) an Array of <code>true</code> and
+ *                           <code>false</code>, like <code>match?</code>.
+ * <code>:offsets</code>::   a binary String of native 32-bit integers, the
+ *                           begin and end byte offsets of the first match
+ *                           of each element, or -1, -1 for no match; read
+ *                           it with <code>unpack('l*')</code>.
+ * <code>:captures</code>::  an Array holding, for each element, the
+ *                           matched String followed by its groups, or
+ *                           <code>nil</code> for no match.
+ *
+ * The first two modes create no objects per element. No
+ * <code>MatchData</code> is created and <code>$~</code> is left alone.
+ * <code>:match_limit</code> and <code>:timeout</code> apply to each search.
+ *
+ *    ORegexp.new('b+').match_many(['abba', 'cd'])                        #=> [true, false]
+ *    ORegexp.new('b+').match_many(['abba', 'cd'], :mode => :offsets).unpack('l*')
+ *                                                                        #=> [1, 3, -1, -1]
+ *    ORegexp.new('(\d+)-(\d+)?').match_many(['1-2', '3-'], :mode => :captures)
+ *                                                                        #=> [['1-2', '1', '2'], ['3-', '3', nil]]
+ */
+static VALUE
+og_oniguruma_oregexp_match_many(int argc, VALUE *argv, VALUE self)
+{
+  og_ORegexp *oregexp;
+  og_MatchManyArgs args;
+  VALUE subjects, options, mode = Qnil;
   
-  if (tainted_replacement)
-    OBJ_INFECT(buffer, replacement);
-  OBJ_INFECT(buffer, str);
+  Data_Get_Struct(self, og_ORegexp, oregexp);
   
-  if (args->update_self) {
-    rb_funcall(str, rb_intern("replace"), 1, buffer);
-    return str;
+  rb_scan_args(argc, argv, "11", &subjects, &options);
+  Check_Type(subjects, T_ARRAY);
+  
+  args.limits = oregexp->limits;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    og_oniguruma_search_limits_parse(&args.limits, options);
+    mode = rb_hash_aref(options, ID2SYM(rb_intern("mode")));
   }
   
-  return buffer;
+  if (NIL_P(mode) || mode == ID2SYM(rb_intern("bool")))
+    args.mode = OG_MATCH_MANY_BOOL;
+  else if (mode == ID2SYM(rb_intern("offsets")))
+    args.mode = OG_MATCH_MANY_OFFSETS;
+  else if (mode == ID2SYM(rb_intern("captures")))
+    args.mode = OG_MATCH_MANY_CAPTURES;
+  else
+    rb_raise(rb_eArgError, "unknown mode, expected :bool, :offsets or :captures");
+  
+  og_oniguruma_oregexp_ensure_compiled(oregexp);
+  
+  args.self = self;
+  args.subjects = subjects;
+  args.region = og_oniguruma_oregexp_region_acquire(oregexp);
+  return rb_ensure(og_oniguruma_oregexp_do_match_many, (VALUE)&args,
+    og_oniguruma_oregexp_do_match_many_cleanup, (VALUE)&args);
 }
 
 static VALUE
-og_oniguruma_oregexp_do_cleanup(OnigRegion *region)
+og_oniguruma_oregexp_do_substitution_cleanup(og_SubstitutionArgs *args)
 {
-  onig_region_free(region, 1);
-  return Qnil;
+  return og_oniguruma_oregexp_do_cleanup(args->self, args->region);
 }
 
 static VALUE
 og_oniguruma_oregexp_do_substitution_safe(VALUE self,
   int argc, VALUE *argv, int global, int update_self)
 {
-  OnigRegion *region = onig_region_new();
+  og_ORegexp *oregexp;
   og_SubstitutionArgs fargs;
   
-  og_SubstitutionArgs_set(&fargs, self, argc, argv, global, update_self, region);
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  
+  /* A Hash second argument is the replacement unless a block is given */
+  og_oniguruma_oregexp_call_limits(oregexp, &argc, argv, rb_block_given_p() ? 1 : 2, &fargs.limits);
+  og_SubstitutionArgs_set(&fargs, self, argc, argv, global, update_self,
+    og_oniguruma_oregexp_region_acquire(oregexp));
   return rb_ensure(og_oniguruma_oregexp_do_substitution, (VALUE)&fargs,
-    og_oniguruma_oregexp_do_cleanup, (VALUE)region);
+    og_oniguruma_oregexp_do_substitution_cleanup, (VALUE)&fargs);
 }
 
 /*
  * Document-method: gsub
  *
  * call-seq:
- *     rxp.gsub(str, replacement)
- *     rxp.gsub(str) {|match_data| ... }
+ *     rxp.gsub(str, replacement, options_hash=nil)
+ *     rxp.gsub(str, options_hash=nil) {|match_data| ... }
  *
  * Returns a copy of _str_ with _all_ occurrences of _rxp_ pattern
  * replaced with either _replacement_ or the value of the block.
@@ -649,8 +1493,8 @@ og_oniguruma_oregexp_gsub(int argc, VALUE *argv, VALUE self)
  * Document-method: gsub!
  *
  * call-seq:
- *     rxp.gsub!(str, replacement)
- *     rxp.gsub!(str) {|match_data| ... }
+ *     rxp.gsub!(str, replacement, options_hash=nil)
+ *     rxp.gsub!(str, options_hash=nil) {|match_data| ... }
  *
  * Performs the substitutions of ORegexp#gsub in place, returning
  * _str_, or _nil_ if no substitutions were performed
@@ -665,8 +1509,8 @@ og_oniguruma_oregexp_gsub_bang(int argc, VALUE *argv, VALUE self)
  * Document-method: sub
  *
  * call-seq:
- *     rxp.sub(str, replacement)
- *     rxp.sub(str) {|match_data| ... }
+ *     rxp.sub(str, replacement, options_hash=nil)
+ *     rxp.sub(str, options_hash=nil) {|match_data| ... }
  *
  * Returns a copy of _str_ with the _first_ occurrence of _rxp_ pattern
  * replaced with either _replacement_ or the value of the block.
@@ -688,8 +1532,8 @@ og_oniguruma_oregexp_sub(int argc, VALUE *argv, VALUE self)
  * Document-method: sub!
  *
  * call-seq:
- *     oregexp.sub!(str, replacement)
- *     oregexp.sub!(str) {|match_data| ... }
+ *     oregexp.sub!(str, replacement, options_hash=nil)
+ *     oregexp.sub!(str, options_hash=nil) {|match_data| ... }
  *
  * Performs the substitutions of ORegexp#sub in place, returning
  * _str_, or _nil_ if no substitutions were performed.
@@ -704,33 +1548,41 @@ og_oniguruma_oregexp_sub_bang(int argc, VALUE *argv, VALUE self)
 static VALUE
 og_oniguruma_oregexp_do_scan(og_ScanArgs *args)
 { 
-  VALUE str, match, matches;
+  VALUE str, match, matches = Qnil;
   OnigEncoding encoding;
   og_ORegexp *oregexp;
-  long begin = 0, end = 0, multibyte_diff = 0;
+  long begin = 0, end = 0, multibyte_diff = 0, count = 0;
+  int yield = rb_block_given_p();
   
   Data_Get_Struct(args->self, og_ORegexp, oregexp);
   
   str = StringValue(args->str);
   
-  begin = onig_search(oregexp->reg,
-    OG_STRING_PTR(str), OG_STRING_PTR(str) + RSTRING_LEN(str),
-    OG_STRING_PTR(str), OG_STRING_PTR(str) + RSTRING_LEN(str),
-    args->region, ONIG_OPTION_NONE);
+  begin = og_oniguruma_oregexp_search(oregexp, str,
+    0, RSTRING_LEN(str), args->region, ONIG_OPTION_NONE, &args->limits);
     
+  if (begin < 0 && begin != ONIG_MISMATCH)
+    og_oniguruma_search_error(begin);
+  
   if (begin < 0)
-    return Qnil;
+    return yield ? str : Qnil;
   
-  matches = rb_ary_new();
+  /* With a block the matches are only yielded, so memory stays flat */
+  if (!yield)
+    matches = rb_ary_new();
   encoding = onig_get_encoding(oregexp->reg);
   
   do {
-    match = og_oniguruma_oregexp_do_match(args->self, args->region, str);
     end = args->region->end[0];
-    rb_ary_push(matches, match);
+    match = og_oniguruma_oregexp_do_match(args->self, args->region, str);
     
-    if (rb_block_given_p())
+    if (yield)
       rb_yield(match);
+    else
+      rb_ary_push(matches, match);
+    
+    if (++count == args->limit)
+      return yield ? str : matches;
     
     if (end == begin) {
       if( RSTRING_LEN(str) <= end )
@@ -739,37 +1591,388 @@ og_oniguruma_oregexp_do_scan(og_ScanArgs *args)
       end += multibyte_diff;
     }
     
-    begin = onig_search(oregexp->reg,
-      OG_STRING_PTR(str),       OG_STRING_PTR(str) + RSTRING_LEN(str),
-      OG_STRING_PTR(str) + end, OG_STRING_PTR(str) + RSTRING_LEN(str),
-      args->region, ONIG_OPTION_NONE);
+    begin = og_oniguruma_oregexp_search(oregexp, str,
+      end, RSTRING_LEN(str), args->region, ONIG_OPTION_NONE, &args->limits);
   } while (begin >= 0);
   
-  return matches;
+  if (begin != ONIG_MISMATCH)
+    og_oniguruma_search_error(begin);
+  
+  return yield ? str : matches;
+}
+
+static VALUE
+og_oniguruma_oregexp_do_scan_cleanup(og_ScanArgs *args)
+{
+  return og_oniguruma_oregexp_do_cleanup(args->self, args->region);
+}
+
+static VALUE
+og_oniguruma_oregexp_scan_with_options(VALUE self, int argc, VALUE *argv)
+{
+  og_ORegexp *oregexp;
+  og_ScanArgs fargs;
+  VALUE str, limit = Qnil;
+  int given = argc;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  og_oniguruma_oregexp_call_limits(oregexp, &argc, argv, 1, &fargs.limits);
+  rb_scan_args(argc, argv, "1", &str);
+  
+  /* call_limits left the trailing Hash, if any, just past argc */
+  if (argc < given)
+    limit = rb_hash_aref(argv[argc], ID2SYM(rb_intern("limit")));
+  if (!NIL_P(limit) && NUM2LONG(limit) <= 0)
+    rb_raise(rb_eArgError, "limit must be positive");
+  
+  og_ScanArgs_set(&fargs, self, str, og_oniguruma_oregexp_region_acquire(oregexp));
+  if (!NIL_P(limit))
+    fargs.limit = NUM2LONG(limit);
+  
+  return rb_ensure(og_oniguruma_oregexp_do_scan, (VALUE)&fargs,
+    og_oniguruma_oregexp_do_scan_cleanup, (VALUE)&fargs);
 }
 
 /*
  * Document-method: scan
  *
  * call-seq:
- *     rxp.scan(str)                        # => [matchdata1, matchdata2,...] or nil
- *     rxp.scan(str) {|match_data| ... }    # => [matchdata1, matchdata2,...] or nil
+ *     rxp.scan(str, options_hash=nil)                        # => [matchdata1, matchdata2,...] or nil
+ *     rxp.scan(str, options_hash=nil) {|match_data| ... }    # => str
  *
  * Both forms iterate through _str_, matching the pattern. For each match,
- * a MatchData object is generated and passed to the block, and
- * added to the resulting array of MatchData objects.
+ * a MatchData object is generated and passed to the block, or, without a
+ * block, added to the resulting array of MatchData objects. With a block
+ * the matches are not kept, so memory does not grow with their number.
+ *
+ * With a block _str_ is returned, as String#scan does. Earlier versions
+ * returned the array of MatchData objects, or _nil_, with a block as well;
+ * callers using that result have to drop the block or collect the matches
+ * themselves.
+ *
+ * If _str_ does not match pattern, _nil_ is returned when no block is
+ * given. <code>:limit => n</code> stops after the first _n_ matches;
+ * <code>:match_limit</code> and <code>:timeout</code> apply to each search.
+ */
+static VALUE
+og_oniguruma_oregexp_scan(int argc, VALUE *argv, VALUE self)
+{
+  return og_oniguruma_oregexp_scan_with_options(self, argc, argv);
+}
+
+/*
+ * Document-method: each_match
+ *
+ * call-seq:
+ *     rxp.each_match(str, options_hash=nil) {|match_data| ... }   # => str
+ *     rxp.each_match(str, options_hash=nil)                       # => enumerator
+ *
+ * Yields a MatchData for each match in _str_, searching for the next match
+ * only after the block returns. Without a block an Enumerator is returned,
+ * which searches only as far as it is consumed, so
+ * <code>each_match(str).first(10)</code> costs ten searches however large
+ * _str_ is. Takes the same options as <code>scan</code>.
+ *
+ *    ORegexp.new('ERROR \d+').each_match(log).first(3)
+ */
+static VALUE
+og_oniguruma_oregexp_each_match(int argc, VALUE *argv, VALUE self)
+{
+#ifdef RETURN_ENUMERATOR
+  RETURN_ENUMERATOR(self, argc, argv);
+#else
+  rb_need_block();
+#endif
+  
+  return og_oniguruma_oregexp_scan_with_options(self, argc, argv);
+}
+
+static VALUE
+og_oniguruma_oregexp_do_offsets(og_OffsetsArgs *args)
+{
+  int result, i;
+  long count = 0, start = 0, end;
+  og_Program *program;
+  og_ORegexp *oregexp;
+  OnigRegion *region = args->region;
+  VALUE offsets = Qnil;
+  
+  Data_Get_Struct(args->self, og_ORegexp, oregexp);
+  
+  /* Whole matches only need the capture free program */
+  program = oregexp->program;
+  if (args->groups == NULL || (args->group_count == 1 && args->groups[0] == 0))
+    program = og_oniguruma_oregexp_bare_program(oregexp);
+  
+  if (args->groups != NULL)
+    offsets = rb_ary_new();
+  
+  while (start <= RSTRING_LEN(args->str)) {
+    result = og_oniguruma_search_string(program, args->str, start, RSTRING_LEN(args->str),
+      region, ONIG_OPTION_NONE, &args->limits);
+    
+    if (result == ONIG_MISMATCH)
+      break;
+    if (result < 0)
+      og_oniguruma_search_error(result);
+    
+    count++;
+    for (i = 0; i < args->group_count; i++) {
+      rb_ary_push(offsets, INT2FIX(region->beg[args->groups[i]]));
+      rb_ary_push(offsets, INT2FIX(region->end[args->groups[i]]));
+    }
+    
+    end = region->end[0];
+    if (end == result) {
+      if (end >= RSTRING_LEN(args->str))
+        break;
+      end += enc_len(oregexp->key.encoding, OG_STRING_PTR(args->str) + end);
+    }
+    start = end;
+  }
+  
+  return args->groups == NULL ? LONG2NUM(count) : offsets;
+}
+
+static VALUE
+og_oniguruma_oregexp_do_offsets_cleanup(og_OffsetsArgs *args)
+{
+  return og_oniguruma_oregexp_do_cleanup(args->self, args->region);
+}
+
+static VALUE
+og_oniguruma_oregexp_offsets(og_OffsetsArgs *args)
+{
+  og_ORegexp *oregexp;
+  
+  Data_Get_Struct(args->self, og_ORegexp, oregexp);
+  
+  /* Other threads may modify str while the lock is released */
+  args->str = rb_str_new4(StringValue(args->str));
+  args->region = og_oniguruma_oregexp_region_acquire(oregexp);
+  return rb_ensure(og_oniguruma_oregexp_do_offsets, (VALUE)args,
+    og_oniguruma_oregexp_do_offsets_cleanup, (VALUE)args);
+}
+
+/* Group number of an Integer, or of a group name given as a Symbol or String */
+static int
+og_oniguruma_oregexp_group_number(og_ORegexp *oregexp, VALUE group)
+{
+  int number;
+  const UChar *name;
+  
+  if (SYMBOL_P(group))
+    group = rb_str_new2(rb_id2name(SYM2ID(group)));
+  
+  if (TYPE(group) == T_STRING) {
+    name = OG_STRING_PTR(group);
+    number = onig_name_to_backref_number(oregexp->reg, name, name + RSTRING_LEN(group), NULL);
+    if (number < 0)
+      rb_raise(rb_eArgError, "undefined group name reference: %s", StringValueCStr(group));
+    return number;
+  }
+  
+  number = NUM2INT(group);
+  if (number < 0 || number > onig_number_of_captures(oregexp->reg))
+    rb_raise(rb_eArgError, "group %d out of range", number);
+  return number;
+}
+
+/*
+ * Document-method: scan_offsets
+ *
+ * call-seq:
+ *    rxp.scan_offsets(str, options_hash=nil)   => [begin, end, ...]
+ *
+ * Returns the byte offsets of every match in <i>str</i> as one flat Array
+ * of Integers, a begin and end pair per match, without creating any
+ * <code>MatchData</code>. With <code>:groups => [0, 2]</code> each match
+ * contributes a pair for each listed group, by number or name, in that
+ * order; a group that did not take part gives -1, -1.
+ * <code>:match_limit</code> and <code>:timeout</code> apply to each search.
+ *
+ *    ORegexp.new('(\w)=(\d)').scan_offsets('a=1 b=2')                      #=> [0, 3, 4, 7]
+ *    ORegexp.new('(\w)=(\d)').scan_offsets('a=1 b=2', :groups => [1, 2])   #=> [0, 1, 2, 3, 4, 5, 6, 7]
+ */
+static VALUE
+og_oniguruma_oregexp_scan_offsets(int argc, VALUE *argv, VALUE self)
+{
+  int i;
+  og_ORegexp *oregexp;
+  og_OffsetsArgs args;
+  VALUE str, options, groups = Qnil;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  og_oniguruma_oregexp_ensure_compiled(oregexp);
+  
+  rb_scan_args(argc, argv, "11", &str, &options);
+  
+  args.limits = oregexp->limits;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    og_oniguruma_search_limits_parse(&args.limits, options);
+    groups = rb_hash_aref(options, ID2SYM(rb_intern("groups")));
+  }
+  
+  if (NIL_P(groups))
+    groups = rb_ary_new3(1, INT2FIX(0));
+  Check_Type(groups, T_ARRAY);
+  if (RARRAY_LEN(groups) == 0)
+    rb_raise(rb_eArgError, "no groups given");
+  
+  args.group_count = (int)RARRAY_LEN(groups);
+  args.groups = ALLOCA_N(int, args.group_count);
+  for (i = 0; i < args.group_count; i++)
+    args.groups[i] = og_oniguruma_oregexp_group_number(oregexp, rb_ary_entry(groups, i));
+  
+  args.self = self;
+  args.str = str;
+  return og_oniguruma_oregexp_offsets(&args);
+}
+
+/*
+ * Document-method: count
+ *
+ * call-seq:
+ *    rxp.count(str, options_hash=nil)   => int
+ *
+ * Returns the number of matches <code>scan</code> would find in
+ * <i>str</i>, without creating any objects per match.
+ * <code>:match_limit</code> and <code>:timeout</code> apply to each search.
+ *
+ *    ORegexp.new('^ERROR').count(log)   #=> 42
+ */
+static VALUE
+og_oniguruma_oregexp_count(int argc, VALUE *argv, VALUE self)
+{
+  og_ORegexp *oregexp;
+  og_OffsetsArgs args;
+  VALUE str;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  og_oniguruma_oregexp_call_limits(oregexp, &argc, argv, 1, &args.limits);
+  rb_scan_args(argc, argv, "1", &str);
+  
+  args.self = self;
+  args.str = str;
+  args.groups = NULL;
+  args.group_count = 0;
+  return og_oniguruma_oregexp_offsets(&args);
+}
+
+static VALUE
+og_oniguruma_oregexp_do_scan_captures(og_ScanArgs *args)
+{
+  int result, group, groups;
+  long start = 0, end;
+  og_Program *program;
+  og_ORegexp *oregexp;
+  OnigRegion *region = args->region;
+  VALUE str = args->str, item, items = Qnil;
+  int yield = rb_block_given_p();
+  
+  Data_Get_Struct(args->self, og_ORegexp, oregexp);
+  
+  groups = onig_number_of_captures(oregexp->reg);
+  program = groups > 0 ? oregexp->program : og_oniguruma_oregexp_bare_program(oregexp);
+  
+  if (!yield)
+    items = rb_ary_new();
+  
+  while (start <= RSTRING_LEN(str)) {
+    result = og_oniguruma_search_string(program, str, start, RSTRING_LEN(str),
+      region, ONIG_OPTION_NONE, &args->limits);
+    
+    if (result == ONIG_MISMATCH)
+      break;
+    if (result < 0)
+      og_oniguruma_search_error(result);
+    
+    /* Like String#scan: the match without groups, else an Array of groups */
+    if (groups == 0) {
+      item = rb_str_substr(str, result, region->end[0] - result);
+    } else {
+      item = rb_ary_new2(groups);
+      for (group = 1; group <= groups; group++) {
+        if (region->beg[group] < 0)
+          rb_ary_push(item, Qnil);
+        else
+          rb_ary_push(item, rb_str_substr(str, region->beg[group],
+            region->end[group] - region->beg[group]));
+      }
+    }
+    
+    end = region->end[0];
+    if (yield)
+      rb_yield(item);
+    else
+      rb_ary_push(items, item);
+    
+    if (end == result) {
+      if (end >= RSTRING_LEN(str))
+        break;
+      end += enc_len(oregexp->key.encoding, OG_STRING_PTR(str) + end);
+    }
+    start = end;
+  }
+  
+  return items;
+}
+
+/*
+ * Document-method: scan_captures
+ *
+ * call-seq:
+ *    rxp.scan_captures(str)                 => array
+ *    rxp.scan_captures(str) {|item| ... }   => str
+ *
+ * Scans <i>str</i> the way <code>String#scan</code> does: without groups
+ * each item is the matched String, otherwise it is an Array of the group
+ * Strings, with <code>nil</code> for groups that did not take part. The
+ * items are built straight from the match registers, with no
+ * <code>MatchData</code>, and neither <code>$~</code> nor
+ * <code>ORegexp.last_match</code> is set. A trailing
+ * <code>{ :match_limit, :timeout }</code> Hash applies to each search.
  *
- * If _str_ does not match pattern, _nil_ is returned.
+ *    ORegexp.new('(\w)=(\d)').scan_captures('a=1 b=2')   #=> [['a', '1'], ['b', '2']]
+ *    ORegexp.new('\d').scan_captures('a=1 b=2')          #=> ['1', '2']
  */
 static VALUE
-og_oniguruma_oregexp_scan(VALUE self, VALUE str)
+og_oniguruma_oregexp_scan_captures(int argc, VALUE *argv, VALUE self)
 {
-  OnigRegion *region = onig_region_new();
+  og_ORegexp *oregexp;
   og_ScanArgs fargs;
+  VALUE str, items;
   
-  og_ScanArgs_set(&fargs, self, str, region);
-  return rb_ensure(og_oniguruma_oregexp_do_scan, (VALUE)&fargs,
-    og_oniguruma_oregexp_do_cleanup, (VALUE)region);
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  og_oniguruma_oregexp_ensure_compiled(oregexp);
+  og_oniguruma_oregexp_call_limits(oregexp, &argc, argv, 1, &fargs.limits);
+  rb_scan_args(argc, argv, "1", &str);
+  StringValue(str);
+  
+  /* The block may modify str; items are cut from a frozen copy */
+  og_ScanArgs_set(&fargs, self, rb_str_new4(str), og_oniguruma_oregexp_region_acquire(oregexp));
+  items = rb_ensure(og_oniguruma_oregexp_do_scan_captures, (VALUE)&fargs,
+    og_oniguruma_oregexp_do_scan_cleanup, (VALUE)&fargs);
+  
+  return rb_block_given_p() ? str : items;
+}
+
+/*
+ * Document-method: compiled?
+ *
+ * call-seq:
+ *    rxp.compiled?   => true or false
+ *
+ * Returns <code>false</code> for a lazy regexp which has not been used yet.
+ */
+static VALUE
+og_oniguruma_oregexp_compiled(VALUE self)
+{
+  og_ORegexp *oregexp;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  return oregexp->reg != NULL ? Qtrue : Qfalse;
 }
 
 /*
@@ -783,15 +1986,11 @@ og_oniguruma_oregexp_scan(VALUE self, VALUE str)
 static VALUE
 og_oniguruma_oregexp_casefold(VALUE self)
 {
-  int options, ignore_case;
-  VALUE og_mOniguruma;
-  
-  og_mOniguruma = rb_const_get(rb_cObject, rb_intern(OG_M_ONIGURUMA));
+  og_ORegexp *oregexp;
   
-  options = FIX2INT(rb_iv_get(self, "@options"));
-  ignore_case = FIX2INT(rb_const_get(og_mOniguruma, rb_intern("OPTION_IGNORECASE")));
+  Data_Get_Struct(self, og_ORegexp, oregexp);
   
-  if ((options & ignore_case) > 0)
+  if ((oregexp->options & ONIG_OPTION_IGNORECASE) > 0)
     return Qtrue;
   return Qfalse;
 }
@@ -801,7 +2000,6 @@ og_oniguruma_oregexp_casefold(VALUE self)
  *
  * call-seq:
  *    rxp == other_rxp      => true or false
- *    rxp.eql?(other_rxp)   => true or false
  *
  * Equality---Two regexps are equal if their patterns are identical, they have
  * the same character set code, and their <code>#casefold?</code> values are the
@@ -810,23 +2008,72 @@ og_oniguruma_oregexp_casefold(VALUE self)
 static VALUE
 og_oniguruma_oregexp_operator_equality(VALUE self, VALUE rhs)
 {
-  VALUE pattern, encoding, rhs_pattern, rhs_encoding;
+  og_ORegexp *oregexp, *rhs_oregexp;
   
-  /* TODO: test type, make sure its an Oniguruma::ORegexp object */
+  if (self == rhs)
+    return Qtrue;
   
-  encoding = rb_iv_get(self, "@encoding");
-  pattern = rb_iv_get(self, "@pattern");
+  if (!rb_obj_is_kind_of(rhs, rb_obj_class(self)))
+    return Qfalse;
   
-  rhs_encoding = rb_iv_get(rhs, "@encoding");
-  rhs_pattern = rb_iv_get(rhs, "@pattern");
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  Data_Get_Struct(rhs, og_ORegexp, rhs_oregexp);
   
-  if (rb_str_cmp(pattern, rhs_pattern) == 0    &&
-    FIX2INT(encoding) == FIX2INT(rhs_encoding) &&
-    og_oniguruma_oregexp_casefold(self) == og_oniguruma_oregexp_casefold(rhs))
+  if (oregexp->key.length == rhs_oregexp->key.length   &&
+    oregexp->encoding == rhs_oregexp->encoding        &&
+    (oregexp->options & ONIG_OPTION_IGNORECASE) == (rhs_oregexp->options & ONIG_OPTION_IGNORECASE) &&
+    memcmp(oregexp->key.pattern, rhs_oregexp->key.pattern, oregexp->key.length) == 0)
       return Qtrue;
   return Qfalse;
 }
 
+/*
+ * Document-method: eql?
+ *
+ * call-seq:
+ *    rxp.eql?(other_rxp)   => true or false
+ *
+ * Strict equality---Two regexps are <code>eql?</code> if their patterns,
+ * options, encodings and syntaxes are all identical. Regexps for which this
+ * holds share one compiled program.
+ */
+static VALUE
+og_oniguruma_oregexp_eql(VALUE self, VALUE rhs)
+{
+  og_ORegexp *oregexp, *rhs_oregexp;
+  
+  if (self == rhs)
+    return Qtrue;
+  
+  if (!rb_obj_is_kind_of(rhs, rb_obj_class(self)))
+    return Qfalse;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  Data_Get_Struct(rhs, og_ORegexp, rhs_oregexp);
+  
+  if (og_oniguruma_pattern_key_equal(&oregexp->key, &rhs_oregexp->key))
+    return Qtrue;
+  return Qfalse;
+}
+
+/*
+ * Document-method: hash
+ *
+ * call-seq:
+ *    rxp.hash   => fixnum
+ *
+ * Returns a hash code computed once from the pattern, options, encoding and
+ * syntax, so ORegexp objects can be used as <code>Hash</code> keys.
+ */
+static VALUE
+og_oniguruma_oregexp_hash(VALUE self)
+{
+  og_ORegexp *oregexp;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  return LONG2FIX((long)(oregexp->key.hash & FIXNUM_MAX));
+}
+
 /*
  * Document-method: ===
  *
@@ -906,7 +2153,10 @@ og_oniguruma_oregexp_operator_match(VALUE self, VALUE str)
 static VALUE
 og_oniguruma_oregexp_kcode(VALUE self)
 {
-  return rb_iv_get(self, "@encoding");
+  og_ORegexp *oregexp;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  return INT2FIX(oregexp->encoding);
 }
 
 /*
@@ -930,7 +2180,10 @@ og_oniguruma_oregexp_kcode(VALUE self)
 static VALUE
 og_oniguruma_oregexp_options(VALUE self)
 {
-  return rb_iv_get(self, "@options");
+  og_ORegexp *oregexp;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  return INT2FIX(oregexp->options);
 }
 
 /*
@@ -946,9 +2199,10 @@ og_oniguruma_oregexp_options(VALUE self)
 static VALUE
 og_oniguruma_oregexp_source(VALUE self)
 {
-  VALUE pattern = rb_iv_get(self, "@pattern");
-  OBJ_FREEZE(pattern);
-  return pattern;
+  og_ORegexp *oregexp;
+  
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+  return oregexp->pattern;
 }
 
 /*
@@ -975,38 +2229,40 @@ og_oniguruma_oregexp_source(VALUE self)
 static VALUE
 og_oniguruma_oregexp_to_s(VALUE self)
 {
-  int options;
-  VALUE str, og_mOniguruma;
+  OnigOptionType options;
+  og_ORegexp *oregexp;
+  VALUE str;
   
-  og_mOniguruma = rb_const_get(rb_cObject, rb_intern(OG_M_ONIGURUMA));
+  Data_Get_Struct(self, og_ORegexp, oregexp);
   
-  options = FIX2INT(og_oniguruma_oregexp_options(self));
+  options = oregexp->options;
   str = rb_str_new2("(?");
   
-  if ((options & FIX2INT(rb_const_get(og_mOniguruma, rb_intern("OPTION_IGNORECASE")))) > 0)
+  if ((options & ONIG_OPTION_IGNORECASE) > 0)
     rb_str_cat(str, "i", 1);
 
-  if ((options & FIX2INT(rb_const_get(og_mOniguruma, rb_intern("OPTION_MULTILINE")))) > 0)
+  if ((options & ONIG_OPTION_MULTILINE) > 0)
     rb_str_cat(str, "m", 1);
 
-  if ((options & FIX2INT(rb_const_get(og_mOniguruma, rb_intern("OPTION_EXTEND")))) > 0)
+  if ((options & ONIG_OPTION_EXTEND) > 0)
     rb_str_cat(str, "x", 1);
   
-  if (rb_str_cmp(str, rb_str_new2("(?imx")) != 0) {
+  if ((options & (ONIG_OPTION_IGNORECASE | ONIG_OPTION_MULTILINE | ONIG_OPTION_EXTEND)) !=
+    (ONIG_OPTION_IGNORECASE | ONIG_OPTION_MULTILINE | ONIG_OPTION_EXTEND)) {
     rb_str_cat(str, "-", 1);
     
-    if ((options & FIX2INT(rb_const_get(og_mOniguruma, rb_intern("OPTION_IGNORECASE")))) == 0)
+    if ((options & ONIG_OPTION_IGNORECASE) == 0)
       rb_str_cat(str, "i", 1);
 
-    if ((options & FIX2INT(rb_const_get(og_mOniguruma, rb_intern("OPTION_MULTILINE")))) == 0)
+    if ((options & ONIG_OPTION_MULTILINE) == 0)
       rb_str_cat(str, "m", 1);
 
-    if ((options & FIX2INT(rb_const_get(og_mOniguruma, rb_intern("OPTION_EXTEND")))) == 0)
+    if ((options & ONIG_OPTION_EXTEND) == 0)
       rb_str_cat(str, "x", 1);
   }
   
   rb_str_cat(str, ":", 1);
-  rb_str_concat(str, rb_iv_get(self, "@pattern"));
+  rb_str_concat(str, oregexp->pattern);
   return rb_str_cat(str, ")", 1);
 }
 
@@ -1024,23 +2280,24 @@ og_oniguruma_oregexp_to_s(VALUE self)
 static VALUE
 og_oniguruma_oregexp_inspect(VALUE self)
 {
-  int options;
-  VALUE str, og_mOniguruma;
+  OnigOptionType options;
+  og_ORegexp *oregexp;
+  VALUE str;
   
-  og_mOniguruma = rb_const_get(rb_cObject, rb_intern(OG_M_ONIGURUMA));
+  Data_Get_Struct(self, og_ORegexp, oregexp);
   
-  options = FIX2INT(og_oniguruma_oregexp_options(self));
+  options = oregexp->options;
   str = rb_str_new2("/");
-  rb_str_concat(str, rb_iv_get(self, "@pattern"));
+  rb_str_concat(str, oregexp->pattern);
   rb_str_cat(str, "/", 1);
   
-  if ((options & FIX2INT(rb_const_get(og_mOniguruma, rb_intern("OPTION_IGNORECASE")))) > 0)
+  if ((options & ONIG_OPTION_IGNORECASE) > 0)
     rb_str_cat(str, "i", 1);
 
-  if ((options & FIX2INT(rb_const_get(og_mOniguruma, rb_intern("OPTION_MULTILINE")))) > 0)
+  if ((options & ONIG_OPTION_MULTILINE) > 0)
     rb_str_cat(str, "m", 1);
 
-  if ((options & FIX2INT(rb_const_get(og_mOniguruma, rb_intern("OPTION_EXTEND")))) > 0)
+  if ((options & ONIG_OPTION_EXTEND) > 0)
     rb_str_cat(str, "x", 1);
   
   return str;
@@ -1052,24 +2309,60 @@ og_oniguruma_oregexp(VALUE mod, const char* name)
   VALUE og_cOniguruma_ORegexp, og_cOniguruma_ORegexp_Singleton;
   
   og_cOniguruma_ORegexp = rb_define_class_under(mod, name, rb_cObject);
+  og_id_last_match = rb_intern("__oniguruma_last_match__");
   rb_define_alloc_func(og_cOniguruma_ORegexp, og_oniguruma_oregexp_alloc);
   
   /* Now add the methods to the class */
   rb_define_singleton_method(og_cOniguruma_ORegexp, "escape",     og_oniguruma_oregexp_escape,      -1);
   rb_define_singleton_method(og_cOniguruma_ORegexp, "last_match", og_oniguruma_oregexp_last_match,  -1);
+  rb_define_singleton_method(og_cOniguruma_ORegexp, "track_last_match=", og_oniguruma_oregexp_set_track_last_match, 1);
+  rb_define_singleton_method(og_cOniguruma_ORegexp, "track_last_match?", og_oniguruma_oregexp_track_last_match,     0);
+  rb_define_singleton_method(og_cOniguruma_ORegexp, "warm",       og_oniguruma_oregexp_warm,         1);
+  rb_define_singleton_method(og_cOniguruma_ORegexp, "compile_all", og_oniguruma_oregexp_compile_all, -1);
+  
+  /* Pattern cache class methods */
+  og_oniguruma_cache(og_cOniguruma_ORegexp);
+  
+  /* Compiled program introspection */
+  og_oniguruma_analysis(og_cOniguruma_ORegexp);
+  
+  /* Searching without the interpreter lock */
+  og_oniguruma_search(mod, og_cOniguruma_ORegexp);
+  
+  /* Matching many patterns at once */
+  og_oniguruma_set(og_cOniguruma_ORegexp);
+  
+  /* Scanning IO streams and files */
+  og_oniguruma_stream(og_cOniguruma_ORegexp);
+  og_oniguruma_file(og_cOniguruma_ORegexp);
+  
+  /* Scanning one string on several threads */
+  og_oniguruma_parallel(og_cOniguruma_ORegexp);
   
   /* Define Instance Methods */
   rb_define_method(og_cOniguruma_ORegexp, "initialize", og_oniguruma_oregexp_initialize,            -1);
   rb_define_method(og_cOniguruma_ORegexp, "match",      og_oniguruma_oregexp_match,                 -1);
+  rb_define_method(og_cOniguruma_ORegexp, "omatch",     og_oniguruma_oregexp_omatch,                -1);
+  rb_define_method(og_cOniguruma_ORegexp, "match?",     og_oniguruma_oregexp_match_p,               -1);
+  rb_define_method(og_cOniguruma_ORegexp, "index",      og_oniguruma_oregexp_index,                 -1);
+  rb_define_method(og_cOniguruma_ORegexp, "start_with?", og_oniguruma_oregexp_start_with_p,         -1);
+  rb_define_method(og_cOniguruma_ORegexp, "match_many", og_oniguruma_oregexp_match_many,            -1);
   rb_define_method(og_cOniguruma_ORegexp, "=~",         og_oniguruma_oregexp_operator_match,         1);
   rb_define_method(og_cOniguruma_ORegexp, "==",         og_oniguruma_oregexp_operator_equality,      1);
   rb_define_method(og_cOniguruma_ORegexp, "===",        og_oniguruma_oregexp_operator_identical,     1);
+  rb_define_method(og_cOniguruma_ORegexp, "eql?",       og_oniguruma_oregexp_eql,                    1);
+  rb_define_method(og_cOniguruma_ORegexp, "hash",       og_oniguruma_oregexp_hash,                   0);
   rb_define_method(og_cOniguruma_ORegexp, "sub",        og_oniguruma_oregexp_sub,                   -1);
   rb_define_method(og_cOniguruma_ORegexp, "sub!",       og_oniguruma_oregexp_sub_bang,              -1);
   rb_define_method(og_cOniguruma_ORegexp, "gsub",       og_oniguruma_oregexp_gsub,                  -1);
   rb_define_method(og_cOniguruma_ORegexp, "gsub!",      og_oniguruma_oregexp_gsub_bang,             -1);
-  rb_define_method(og_cOniguruma_ORegexp, "scan",       og_oniguruma_oregexp_scan,                   1);
+  rb_define_method(og_cOniguruma_ORegexp, "scan",       og_oniguruma_oregexp_scan,                  -1);
+  rb_define_method(og_cOniguruma_ORegexp, "each_match", og_oniguruma_oregexp_each_match,            -1);
+  rb_define_method(og_cOniguruma_ORegexp, "scan_offsets", og_oniguruma_oregexp_scan_offsets,        -1);
+  rb_define_method(og_cOniguruma_ORegexp, "scan_captures", og_oniguruma_oregexp_scan_captures,      -1);
+  rb_define_method(og_cOniguruma_ORegexp, "count",      og_oniguruma_oregexp_count,                 -1);
   rb_define_method(og_cOniguruma_ORegexp, "casefold?",  og_oniguruma_oregexp_casefold,               0);
+  rb_define_method(og_cOniguruma_ORegexp, "compiled?",  og_oniguruma_oregexp_compiled,               0);
   rb_define_method(og_cOniguruma_ORegexp, "kcode",      og_oniguruma_oregexp_kcode,                  0);
   rb_define_method(og_cOniguruma_ORegexp, "options",    og_oniguruma_oregexp_options,                0);
   rb_define_method(og_cOniguruma_ORegexp, "source",     og_oniguruma_oregexp_source,                 0);
@@ -1078,7 +2371,6 @@ og_oniguruma_oregexp(VALUE mod, const char* name)
   
   /* Define Aliases */
   /* Instance method aliases */
-  rb_define_alias(og_cOniguruma_ORegexp, "eql?", "==");
   rb_define_alias(og_cOniguruma_ORegexp, "match_all", "scan");
   
   /* Class method aliases */
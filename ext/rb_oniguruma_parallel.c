@@ -0,0 +1,290 @@
+#include "rb_oniguruma.h"
+#include "rb_oniguruma_pool.h"
+
+/*
+ * Scanning one large subject on several native threads. The subject is cut
+ * into pieces just after occurrences of a delimiter, and every piece is
+ * scanned on the pool, with the engine still seeing the whole subject for
+ * look-behind and look-ahead. A piece's matches are the same as a scan of
+ * the whole subject would find there as long as no match spans a
+ * delimiter; a match that does makes the scan refuse the pattern, whatever
+ * the pieces turned out to be.
+ */
+#define OG_PARALLEL_CROSSING    (-10001)
+
+/* Pieces per thread, so threads finishing early pick up more */
+#define OG_PARALLEL_PIECES      4
+#define OG_PARALLEL_MIN_PIECE   (64 * 1024)
+
+typedef struct og_piece {
+  long start, end;          /* match starts in [start, end) */
+  long *matches;            /* begin, end pairs */
+  long count, capacity;
+  int result;               /* 0, or an error code */
+  int done;
+} og_Piece;
+
+typedef struct og_parallel {
+  og_Program *program;
+  const UChar *str;
+  long length;
+  const UChar *delimiter;
+  long delimiter_length;
+  og_Piece *pieces;
+  long count;
+  int threads;
+  volatile int cancel;
+  volatile int interrupted;
+} og_Parallel;
+
+static void
+og_oniguruma_parallel_push(og_Piece *piece, long begin, long end)
+{
+  if (piece->count == piece->capacity) {
+    piece->capacity = piece->capacity == 0 ? 64 : 2 * piece->capacity;
+    piece->matches = realloc(piece->matches, 2 * piece->capacity * sizeof(long));
+  }
+
+  piece->matches[2 * piece->count]     = begin;
+  piece->matches[2 * piece->count + 1] = end;
+  piece->count++;
+}
+
+static void
+og_oniguruma_parallel_task(void *context, long index)
+{
+  int result;
+  long start, end;
+  og_Parallel *parallel = (og_Parallel*)context;
+  og_Piece *piece = &parallel->pieces[index];
+  int last = piece->end == parallel->length;
+  OnigRegion *region;
+
+  if (piece->done)
+    return;
+
+  region = onig_region_new();
+  piece->count = 0;
+  start = piece->start;
+
+  /* A match starting at the end of the piece belongs to the next one */
+  while (!parallel->cancel && (start < piece->end || (last && start == piece->end))) {
+    result = og_oniguruma_search_native(parallel->program, parallel->str, parallel->length,
+      start, piece->end, region, ONIG_OPTION_NONE);
+
+    if (result == ONIG_MISMATCH || (result == piece->end && !last))
+      break;
+
+    if (result < 0) {
+      piece->result = result;
+      parallel->cancel = 1;
+      break;
+    }
+
+    end = region->end[0];
+    if (end > piece->end || og_oniguruma_search_literal(parallel->str + result, end - result,
+          parallel->delimiter, parallel->delimiter_length) != NULL) {
+      piece->result = OG_PARALLEL_CROSSING;
+      parallel->cancel = 1;
+      break;
+    }
+
+    og_oniguruma_parallel_push(piece, result, end);
+
+    if (end == result) {
+      if (end >= parallel->length)
+        break;
+      end += enc_len(parallel->program->key.encoding, parallel->str + end);
+    }
+    start = end;
+  }
+
+  if (!parallel->cancel || piece->result != 0)
+    piece->done = 1;
+
+  onig_region_free(region, 1);
+}
+
+static void*
+og_oniguruma_parallel_run(void *arg)
+{
+  og_Parallel *parallel = (og_Parallel*)arg;
+
+  og_oniguruma_pool_run(og_oniguruma_parallel_task, parallel,
+    parallel->count, parallel->threads, &parallel->cancel);
+
+  return NULL;
+}
+
+static void
+og_oniguruma_parallel_ubf(void *arg)
+{
+  og_Parallel *parallel = (og_Parallel*)arg;
+
+  parallel->interrupted = 1;
+  parallel->cancel = 1;
+}
+
+/* Cuts the subject into pieces ending just after a delimiter */
+static void
+og_oniguruma_parallel_split(og_Parallel *parallel)
+{
+  long wanted, size, start = 0, cut;
+  const UChar *found;
+
+  wanted = (long)parallel->threads * OG_PARALLEL_PIECES;
+  if (wanted > parallel->length / OG_PARALLEL_MIN_PIECE)
+    wanted = parallel->length / OG_PARALLEL_MIN_PIECE;
+  if (wanted < 1)
+    wanted = 1;
+
+  size = parallel->length / wanted;
+  parallel->pieces = calloc(wanted, sizeof(og_Piece));
+  parallel->count = 0;
+
+  while (parallel->count < wanted) {
+    cut = parallel->length;
+
+    if (parallel->count + 1 < wanted && start + size < parallel->length) {
+      found = og_oniguruma_search_literal(parallel->str + start + size, parallel->length - start - size,
+        parallel->delimiter, parallel->delimiter_length);
+      if (found != NULL)
+        cut = (found - parallel->str) + parallel->delimiter_length;
+    }
+
+    parallel->pieces[parallel->count].start = start;
+    parallel->pieces[parallel->count].end = cut;
+    parallel->count++;
+
+    if (cut >= parallel->length)
+      break;
+    start = cut;
+  }
+}
+
+static VALUE
+og_oniguruma_parallel_do_scan(og_Parallel *parallel)
+{
+  long i, j;
+  int done;
+  VALUE matches;
+
+  do {
+    parallel->cancel = 0;
+    parallel->interrupted = 0;
+    og_oniguruma_without_gvl(og_oniguruma_parallel_run, parallel, og_oniguruma_parallel_ubf, parallel);
+
+    for (i = 0; i < parallel->count; i++) {
+      if (parallel->pieces[i].result == OG_PARALLEL_CROSSING)
+        rb_raise(rb_eArgError, "a match spans the delimiter, so this pattern can't be scanned in pieces");
+      if (parallel->pieces[i].result != 0)
+        og_oniguruma_search_error(parallel->pieces[i].result);
+    }
+
+    /* Raises if the interrupt was for us, otherwise carry on with what is left */
+    if (parallel->interrupted)
+      og_oniguruma_check_ints();
+
+    done = 1;
+    for (i = 0; i < parallel->count; i++)
+      done = done && parallel->pieces[i].done;
+  } while (!done);
+
+  matches = rb_ary_new();
+  for (i = 0; i < parallel->count; i++)
+    for (j = 0; j < parallel->pieces[i].count; j++)
+      rb_ary_push(matches, rb_assoc_new(LONG2NUM(parallel->pieces[i].matches[2 * j]),
+        LONG2NUM(parallel->pieces[i].matches[2 * j + 1])));
+
+  return matches;
+}
+
+static VALUE
+og_oniguruma_parallel_cleanup(og_Parallel *parallel)
+{
+  long i;
+
+  for (i = 0; i < parallel->count; i++)
+    free(parallel->pieces[i].matches);
+  free(parallel->pieces);
+
+  return Qnil;
+}
+
+/*
+ * Document-method: parallel_scan
+ *
+ * call-seq:
+ *    rxp.parallel_scan(str, options_hash=nil)   => [[begin, end], ...]
+ *
+ * Returns the byte offsets of the matches <code>scan</code> finds in
+ * <i>str</i>, scanning pieces of it on several native threads with the
+ * interpreter lock released. Pieces end just after an occurrence of the
+ * delimiter.
+ *
+ * <code>:delimiter</code>::  the record separator, <code>"\n"</code> by
+ *                            default.
+ * <code>:threads</code>::    how many threads to use, one per processor by
+ *                            default.
+ *
+ * Raises <code>ArgumentError</code> for patterns depending on where the
+ * search starts (<code>\G</code>, <code>OPTION_FIND_LONGEST</code>), and
+ * when a match spans the delimiter, since the pieces could then disagree
+ * with a scan of the whole string.
+ * <code>:match_limit</code> and <code>:timeout</code> do not apply.
+ *
+ *    ORegexp.new('ERROR \d+').parallel_scan(log, :threads => 8)
+ */
+static VALUE
+og_oniguruma_parallel_scan(int argc, VALUE *argv, VALUE self)
+{
+  og_ORegexp *oregexp;
+  og_Parallel parallel;
+  VALUE string, options, threads = Qnil;
+  volatile VALUE subject, delimiter = Qnil;
+
+  rb_scan_args(argc, argv, "11", &string, &options);
+  StringValue(string);
+
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    delimiter = rb_hash_aref(options, ID2SYM(rb_intern("delimiter")));
+    threads = rb_hash_aref(options, ID2SYM(rb_intern("threads")));
+  }
+
+  if (NIL_P(delimiter))
+    delimiter = rb_str_new2("\n");
+  StringValue(delimiter);
+  if (RSTRING_LEN(delimiter) == 0)
+    rb_raise(rb_eArgError, "empty delimiter");
+  delimiter = rb_str_new4(delimiter);
+
+  og_oniguruma_oregexp_reg(self);
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+
+  if (oregexp->program->start_dependent)
+    rb_raise(rb_eArgError, "patterns depending on the search start can't be scanned in pieces");
+
+  /* Other threads may modify string meanwhile; the copy keeps its buffer */
+  subject = rb_str_new4(string);
+
+  parallel.program = oregexp->program;
+  parallel.str = OG_STRING_PTR(subject);
+  parallel.length = RSTRING_LEN(subject);
+  parallel.threads = NIL_P(threads) ? og_oniguruma_pool_default_threads() : NUM2INT(threads);
+  if (parallel.threads < 1)
+    rb_raise(rb_eArgError, "threads must be positive");
+
+  parallel.delimiter = OG_STRING_PTR(delimiter);
+  parallel.delimiter_length = RSTRING_LEN(delimiter);
+  og_oniguruma_parallel_split(&parallel);
+
+  return rb_ensure(og_oniguruma_parallel_do_scan, (VALUE)&parallel,
+    og_oniguruma_parallel_cleanup, (VALUE)&parallel);
+}
+
+void
+og_oniguruma_parallel(VALUE klass)
+{
+  rb_define_method(klass, "parallel_scan", og_oniguruma_parallel_scan, -1);
+}
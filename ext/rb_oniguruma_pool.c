@@ -0,0 +1,106 @@
+#include <unistd.h>
+#include "rb_oniguruma_pool.h"
+
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#ifndef OG_POOL_MAX_THREADS
+#define OG_POOL_MAX_THREADS 64
+#endif
+
+typedef struct og_pool {
+  og_PoolTask task;
+  void *context;
+  long count;
+  long next;
+  volatile int *cancel;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t lock;
+#endif
+} og_Pool;
+
+static long
+og_oniguruma_pool_take(og_Pool *pool)
+{
+  long index;
+  
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock(&pool->lock);
+#endif
+  if (pool->next < pool->count && !(pool->cancel && *pool->cancel))
+    index = pool->next++;
+  else
+    index = -1;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_unlock(&pool->lock);
+#endif
+  
+  return index;
+}
+
+static void*
+og_oniguruma_pool_worker(void *arg)
+{
+  long index;
+  og_Pool *pool = (og_Pool*)arg;
+  
+  while ((index = og_oniguruma_pool_take(pool)) >= 0)
+    pool->task(pool->context, index);
+  
+  return NULL;
+}
+
+int
+og_oniguruma_pool_default_threads(void)
+{
+  long n = 1;
+  
+#ifdef _SC_NPROCESSORS_ONLN
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  
+  if (n < 1) n = 1;
+  if (n > OG_POOL_MAX_THREADS) n = OG_POOL_MAX_THREADS;
+  
+  return (int)n;
+}
+
+void
+og_oniguruma_pool_run(og_PoolTask task, void *context, long count,
+  int threads, volatile int *cancel)
+{
+  og_Pool pool;
+#ifdef HAVE_PTHREAD_H
+  int i, started = 0;
+  pthread_t workers[OG_POOL_MAX_THREADS];
+#endif
+  
+  pool.task = task;
+  pool.context = context;
+  pool.count = count;
+  pool.next = 0;
+  pool.cancel = cancel;
+  
+  if (threads > count) threads = (int)count;
+  if (threads > OG_POOL_MAX_THREADS) threads = OG_POOL_MAX_THREADS;
+  
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_init(&pool.lock, NULL);
+  
+  /* If a thread cannot be started the remaining ones pick up its share */
+  for (i = 1; i < threads; i++) {
+    if (pthread_create(&workers[started], NULL, og_oniguruma_pool_worker, &pool) == 0)
+      started++;
+  }
+#endif
+  
+  og_oniguruma_pool_worker(&pool);
+  
+#ifdef HAVE_PTHREAD_H
+  for (i = 0; i < started; i++)
+    pthread_join(workers[i], NULL);
+  
+  pthread_mutex_destroy(&pool.lock);
+#endif
+}
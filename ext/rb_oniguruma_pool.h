@@ -0,0 +1,19 @@
+#ifndef _RB_ONIGURUMA_POOL_H_
+#define _RB_ONIGURUMA_POOL_H_
+
+/* A unit of work, called once for every index of the batch */
+typedef void (*og_PoolTask)(void *context, long index);
+
+/*
+ * Runs task(context, i) for every i in [0, count) on up to threads native
+ * threads; the calling thread takes part. Workers stop picking up new
+ * indices once *cancel becomes non-zero. Must be called without touching
+ * the Ruby interpreter from the tasks.
+ */
+void og_oniguruma_pool_run(og_PoolTask task, void *context, long count,
+  int threads, volatile int *cancel);
+
+/* Number of online processors, at least 1 */
+int og_oniguruma_pool_default_threads(void);
+
+#endif /* _RB_ONIGURUMA_POOL_H_ */
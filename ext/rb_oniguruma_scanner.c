@@ -0,0 +1,576 @@
+#include "rb_oniguruma.h"
+#include "rb_oniguruma_match.h"
+
+/*
+ * Oniguruma::OScanner is a StringScanner for ORegexp patterns. scan, skip,
+ * check and match? try the pattern only at the scan pointer, as a search
+ * whose range ends where it starts; the xxx_until methods search forward
+ * from it. Both apply the limits of the ORegexp. Every attempt reuses the
+ * one region kept in the scanner, so no MatchData is created unless
+ * omatch is called.
+ */
+typedef struct og_oscanner {
+  VALUE string;
+  VALUE regexp;             /* ORegexp of the last match, for named groups */
+  long pos;                 /* scan pointer, in bytes */
+  long prev;                /* scan pointer before the last match */
+  int matched;
+  OnigRegion *region;
+} og_OScanner;
+
+static VALUE og_cOniguruma_ORegexp;
+
+static void
+og_oniguruma_scanner_mark(void *arg)
+{
+  og_OScanner *scanner = (og_OScanner*)arg;
+  rb_gc_mark(scanner->string);
+  rb_gc_mark(scanner->regexp);
+}
+
+static void
+og_oniguruma_scanner_free(void *arg)
+{
+  og_OScanner *scanner = (og_OScanner*)arg;
+  onig_region_free(scanner->region, 1);
+  free(scanner);
+}
+
+static VALUE
+og_oniguruma_scanner_alloc(VALUE klass)
+{
+  og_OScanner *scanner;
+
+  scanner = malloc(sizeof(og_OScanner));
+  scanner->string = Qnil;
+  scanner->regexp = Qnil;
+  scanner->pos = scanner->prev = 0;
+  scanner->matched = 0;
+  scanner->region = onig_region_new();
+
+  return Data_Wrap_Struct(klass, og_oniguruma_scanner_mark, og_oniguruma_scanner_free, scanner);
+}
+
+static og_OScanner*
+og_oniguruma_scanner_get(VALUE self)
+{
+  og_OScanner *scanner;
+
+  Data_Get_Struct(self, og_OScanner, scanner);
+  if (NIL_P(scanner->string))
+    rb_raise(rb_eArgError, "uninitialized OScanner object");
+  return scanner;
+}
+
+/*
+ * Document-method: new
+ *
+ * call-seq:
+ *    OScanner.new(str)
+ *
+ * Creates a scanner over <i>str</i> with the scan pointer at the start.
+ * The string is not copied; changing it affects the scanner.
+ *
+ *    s = Oniguruma::OScanner.new('3 + foo(4)')
+ */
+static VALUE
+og_oniguruma_scanner_initialize(VALUE self, VALUE string)
+{
+  og_OScanner *scanner;
+
+  Data_Get_Struct(self, og_OScanner, scanner);
+  scanner->string = StringValue(string);
+  scanner->regexp = Qnil;
+  scanner->pos = scanner->prev = 0;
+  scanner->matched = 0;
+
+  return self;
+}
+
+/* Returns pattern as an ORegexp; Strings are compiled with the defaults */
+static VALUE
+og_oniguruma_scanner_regexp(VALUE pattern)
+{
+  if (rb_obj_is_kind_of(pattern, og_cOniguruma_ORegexp))
+    return pattern;
+  return rb_class_new_instance(1, &pattern, og_cOniguruma_ORegexp);
+}
+
+/*
+ * Tries pattern at the scan pointer, or when not anchored searches from
+ * it. On a match the pointer moves to its end when advance is set, and the
+ * skipped text, or its length, is returned; otherwise nil.
+ */
+static VALUE
+og_oniguruma_scanner_do(VALUE self, VALUE pattern, int anchored, int advance, int string_p)
+{
+  int result;
+  long length, end;
+  og_OScanner *scanner = og_oniguruma_scanner_get(self);
+  og_ORegexp *oregexp;
+  VALUE regexp;
+
+  regexp = og_oniguruma_scanner_regexp(pattern);
+  og_oniguruma_oregexp_reg(regexp);
+  Data_Get_Struct(regexp, og_ORegexp, oregexp);
+
+  scanner->matched = 0;
+
+  length = RSTRING_LEN(scanner->string);
+  if (scanner->pos > length)
+    return Qnil;
+
+  result = og_oniguruma_search_string(oregexp->program, scanner->string, scanner->pos,
+    anchored ? scanner->pos : length, scanner->region, ONIG_OPTION_NONE, &oregexp->limits);
+
+  if (result == ONIG_MISMATCH)
+    return Qnil;
+  if (result < 0)
+    og_oniguruma_search_error(result);
+
+  end = scanner->region->end[0];
+
+  scanner->matched = 1;
+  scanner->regexp = regexp;
+  scanner->prev = scanner->pos;
+  if (advance)
+    scanner->pos = end;
+
+  if (string_p)
+    return rb_str_substr(scanner->string, scanner->prev, end - scanner->prev);
+  return LONG2NUM(end - scanner->prev);
+}
+
+/*
+ * Document-method: scan
+ *
+ * call-seq:
+ *    scanner.scan(pattern)   => str or nil
+ *
+ * Tries to match <i>pattern</i>, an ORegexp or a pattern String, exactly at
+ * the scan pointer. On a match the pointer moves past it and the matched
+ * string is returned; otherwise <code>nil</code>.
+ *
+ *    s = Oniguruma::OScanner.new('3 + foo(4)')
+ *    s.scan(ORegexp.new('\d+'))   #=> "3"
+ *    s.scan(ORegexp.new('\d+'))   #=> nil
+ *    s.pos                        #=> 1
+ */
+static VALUE
+og_oniguruma_scanner_scan(VALUE self, VALUE pattern)
+{
+  return og_oniguruma_scanner_do(self, pattern, 1, 1, 1);
+}
+
+/*
+ * Document-method: skip
+ *
+ * call-seq:
+ *    scanner.skip(pattern)   => int or nil
+ *
+ * Like <code>scan</code>, but returns the length of the match.
+ */
+static VALUE
+og_oniguruma_scanner_skip(VALUE self, VALUE pattern)
+{
+  return og_oniguruma_scanner_do(self, pattern, 1, 1, 0);
+}
+
+/*
+ * Document-method: check
+ *
+ * call-seq:
+ *    scanner.check(pattern)   => str or nil
+ *
+ * Like <code>scan</code>, but leaves the scan pointer where it is.
+ */
+static VALUE
+og_oniguruma_scanner_check(VALUE self, VALUE pattern)
+{
+  return og_oniguruma_scanner_do(self, pattern, 1, 0, 1);
+}
+
+/*
+ * Document-method: match?
+ *
+ * call-seq:
+ *    scanner.match?(pattern)   => int or nil
+ *
+ * Returns the length of the match at the scan pointer, without moving it.
+ */
+static VALUE
+og_oniguruma_scanner_match_p(VALUE self, VALUE pattern)
+{
+  return og_oniguruma_scanner_do(self, pattern, 1, 0, 0);
+}
+
+/*
+ * Document-method: scan_until
+ *
+ * call-seq:
+ *    scanner.scan_until(pattern)   => str or nil
+ *
+ * Searches for <i>pattern</i> from the scan pointer on. On a match the
+ * pointer moves past it and everything from the old pointer up to the end
+ * of the match is returned.
+ *
+ *    s = Oniguruma::OScanner.new('3 + foo(4)')
+ *    s.scan_until(ORegexp.new('\('))   #=> "3 + foo("
+ *    s.pre_match                       #=> "3 + foo"
+ */
+static VALUE
+og_oniguruma_scanner_scan_until(VALUE self, VALUE pattern)
+{
+  return og_oniguruma_scanner_do(self, pattern, 0, 1, 1);
+}
+
+/*
+ * Document-method: skip_until
+ *
+ * call-seq:
+ *    scanner.skip_until(pattern)   => int or nil
+ *
+ * Like <code>scan_until</code>, but returns the number of bytes advanced.
+ */
+static VALUE
+og_oniguruma_scanner_skip_until(VALUE self, VALUE pattern)
+{
+  return og_oniguruma_scanner_do(self, pattern, 0, 1, 0);
+}
+
+/*
+ * Document-method: check_until
+ *
+ * call-seq:
+ *    scanner.check_until(pattern)   => str or nil
+ *
+ * Like <code>scan_until</code>, but leaves the scan pointer where it is.
+ */
+static VALUE
+og_oniguruma_scanner_check_until(VALUE self, VALUE pattern)
+{
+  return og_oniguruma_scanner_do(self, pattern, 0, 0, 1);
+}
+
+/*
+ * Document-method: pos
+ *
+ * call-seq:
+ *    scanner.pos   => int
+ *
+ * Returns the byte position of the scan pointer.
+ */
+static VALUE
+og_oniguruma_scanner_pos(VALUE self)
+{
+  return LONG2NUM(og_oniguruma_scanner_get(self)->pos);
+}
+
+/*
+ * Document-method: pos=
+ *
+ * call-seq:
+ *    scanner.pos = int
+ *
+ * Moves the scan pointer to byte <i>int</i>; negative values count from
+ * the end of the string.
+ */
+static VALUE
+og_oniguruma_scanner_set_pos(VALUE self, VALUE position)
+{
+  og_OScanner *scanner = og_oniguruma_scanner_get(self);
+  long pos = NUM2LONG(position), length = RSTRING_LEN(scanner->string);
+
+  if (pos < 0) pos += length;
+  if (pos < 0 || pos > length)
+    rb_raise(rb_eRangeError, "index out of range");
+
+  scanner->pos = pos;
+  scanner->matched = 0;
+  return position;
+}
+
+/*
+ * Document-method: reset
+ *
+ * call-seq:
+ *    scanner.reset   => scanner
+ *
+ * Moves the scan pointer back to the start and forgets the last match.
+ */
+static VALUE
+og_oniguruma_scanner_reset(VALUE self)
+{
+  og_OScanner *scanner = og_oniguruma_scanner_get(self);
+
+  scanner->pos = 0;
+  scanner->matched = 0;
+  return self;
+}
+
+/*
+ * Document-method: terminate
+ *
+ * call-seq:
+ *    scanner.terminate   => scanner
+ *
+ * Moves the scan pointer to the end and forgets the last match.
+ */
+static VALUE
+og_oniguruma_scanner_terminate(VALUE self)
+{
+  og_OScanner *scanner = og_oniguruma_scanner_get(self);
+
+  scanner->pos = RSTRING_LEN(scanner->string);
+  scanner->matched = 0;
+  return self;
+}
+
+/*
+ * Document-method: eos?
+ *
+ * call-seq:
+ *    scanner.eos?   => true or false
+ *
+ * Returns whether the scan pointer is at the end of the string.
+ */
+static VALUE
+og_oniguruma_scanner_eos_p(VALUE self)
+{
+  og_OScanner *scanner = og_oniguruma_scanner_get(self);
+  return scanner->pos >= RSTRING_LEN(scanner->string) ? Qtrue : Qfalse;
+}
+
+/*
+ * Document-method: rest
+ *
+ * call-seq:
+ *    scanner.rest   => str
+ *
+ * Returns the string from the scan pointer on.
+ */
+static VALUE
+og_oniguruma_scanner_rest(VALUE self)
+{
+  og_OScanner *scanner = og_oniguruma_scanner_get(self);
+  long length = RSTRING_LEN(scanner->string);
+
+  if (scanner->pos >= length)
+    return rb_str_new("", 0);
+  return rb_str_substr(scanner->string, scanner->pos, length - scanner->pos);
+}
+
+/*
+ * Document-method: string
+ *
+ * call-seq:
+ *    scanner.string   => str
+ */
+static VALUE
+og_oniguruma_scanner_string(VALUE self)
+{
+  return og_oniguruma_scanner_get(self)->string;
+}
+
+/*
+ * Document-method: string=
+ *
+ * call-seq:
+ *    scanner.string = str
+ *
+ * Scans <i>str</i> from the start instead.
+ */
+static VALUE
+og_oniguruma_scanner_set_string(VALUE self, VALUE string)
+{
+  og_oniguruma_scanner_initialize(self, string);
+  return string;
+}
+
+/*
+ * Document-method: matched?
+ *
+ * call-seq:
+ *    scanner.matched?   => true or false
+ *
+ * Returns whether the last scan, skip, check or xxx_until matched.
+ */
+static VALUE
+og_oniguruma_scanner_matched_p(VALUE self)
+{
+  return og_oniguruma_scanner_get(self)->matched ? Qtrue : Qfalse;
+}
+
+/* Returns the text between the given offsets of the subject, or nil */
+static VALUE
+og_oniguruma_scanner_substr(og_OScanner *scanner, long beg, long end)
+{
+  if (!scanner->matched || beg < 0 || end > RSTRING_LEN(scanner->string))
+    return Qnil;
+  return rb_str_substr(scanner->string, beg, end - beg);
+}
+
+/*
+ * Document-method: matched
+ *
+ * call-seq:
+ *    scanner.matched   => str or nil
+ *
+ * Returns the last matched string.
+ */
+static VALUE
+og_oniguruma_scanner_matched(VALUE self)
+{
+  og_OScanner *scanner = og_oniguruma_scanner_get(self);
+  return og_oniguruma_scanner_substr(scanner, scanner->region->beg[0], scanner->region->end[0]);
+}
+
+/*
+ * Document-method: matched_size
+ *
+ * call-seq:
+ *    scanner.matched_size   => int or nil
+ *
+ * Returns the byte length of the last match.
+ */
+static VALUE
+og_oniguruma_scanner_matched_size(VALUE self)
+{
+  og_OScanner *scanner = og_oniguruma_scanner_get(self);
+
+  if (!scanner->matched)
+    return Qnil;
+  return LONG2NUM(scanner->region->end[0] - scanner->region->beg[0]);
+}
+
+/*
+ * Document-method: []
+ *
+ * call-seq:
+ *    scanner[i]        => str or nil
+ *    scanner[symbol]   => str or nil
+ *
+ * Returns group <i>i</i>, or the named group <i>symbol</i>, of the last
+ * match.
+ *
+ *    s = Oniguruma::OScanner.new('width: 10px')
+ *    s.scan(ORegexp.new('(?<name>\w+):\s*(?<value>\d+)'))
+ *    s[:value]   #=> "10"
+ */
+static VALUE
+og_oniguruma_scanner_aref(VALUE self, VALUE group)
+{
+  int n;
+  og_OScanner *scanner = og_oniguruma_scanner_get(self);
+  og_ORegexp *oregexp;
+  VALUE index;
+
+  if (!scanner->matched)
+    return Qnil;
+
+  if (SYMBOL_P(group) || TYPE(group) == T_STRING) {
+    Data_Get_Struct(scanner->regexp, og_ORegexp, oregexp);
+    if (TYPE(group) == T_STRING)
+      group = ID2SYM(rb_intern(StringValueCStr(group)));
+
+    index = NIL_P(oregexp->names) ? Qnil : rb_hash_aref(oregexp->names, group);
+    if (NIL_P(index))
+      rb_raise(rb_eIndexError, "undefined group name reference: %s", rb_id2name(SYM2ID(group)));
+    n = FIX2INT(index);
+  } else {
+    n = NUM2INT(group);
+    if (n < 0) n += scanner->region->num_regs;
+    if (n < 0 || n >= scanner->region->num_regs)
+      return Qnil;
+  }
+
+  return og_oniguruma_scanner_substr(scanner, scanner->region->beg[n], scanner->region->end[n]);
+}
+
+/*
+ * Document-method: pre_match
+ *
+ * call-seq:
+ *    scanner.pre_match   => str or nil
+ *
+ * Returns the string before the last match.
+ */
+static VALUE
+og_oniguruma_scanner_pre_match(VALUE self)
+{
+  og_OScanner *scanner = og_oniguruma_scanner_get(self);
+  return og_oniguruma_scanner_substr(scanner, 0, scanner->region->beg[0]);
+}
+
+/*
+ * Document-method: post_match
+ *
+ * call-seq:
+ *    scanner.post_match   => str or nil
+ *
+ * Returns the string after the last match.
+ */
+static VALUE
+og_oniguruma_scanner_post_match(VALUE self)
+{
+  og_OScanner *scanner = og_oniguruma_scanner_get(self);
+  return og_oniguruma_scanner_substr(scanner, scanner->region->end[0], RSTRING_LEN(scanner->string));
+}
+
+/*
+ * Document-method: omatch
+ *
+ * call-seq:
+ *    scanner.omatch   => omatch or nil
+ *
+ * Returns the last match as an <code>Oniguruma::OMatch</code>.
+ */
+static VALUE
+og_oniguruma_scanner_omatch(VALUE self)
+{
+  og_OScanner *scanner = og_oniguruma_scanner_get(self);
+  og_ORegexp *oregexp;
+
+  if (!scanner->matched)
+    return Qnil;
+
+  Data_Get_Struct(scanner->regexp, og_ORegexp, oregexp);
+  return og_oniguruma_omatch_new(scanner->region, scanner->string, oregexp->names);
+}
+
+void
+og_oniguruma_scanner(VALUE mod)
+{
+  VALUE og_cOniguruma_OScanner;
+
+  og_cOniguruma_ORegexp = rb_const_get(mod, rb_intern(OG_C_OREGEXP));
+  og_cOniguruma_OScanner = rb_define_class_under(mod, OG_C_OSCANNER, rb_cObject);
+  rb_define_alloc_func(og_cOniguruma_OScanner, og_oniguruma_scanner_alloc);
+
+  rb_define_method(og_cOniguruma_OScanner, "initialize",   og_oniguruma_scanner_initialize,    1);
+  rb_define_method(og_cOniguruma_OScanner, "scan",         og_oniguruma_scanner_scan,          1);
+  rb_define_method(og_cOniguruma_OScanner, "skip",         og_oniguruma_scanner_skip,          1);
+  rb_define_method(og_cOniguruma_OScanner, "check",        og_oniguruma_scanner_check,         1);
+  rb_define_method(og_cOniguruma_OScanner, "match?",       og_oniguruma_scanner_match_p,       1);
+  rb_define_method(og_cOniguruma_OScanner, "scan_until",   og_oniguruma_scanner_scan_until,    1);
+  rb_define_method(og_cOniguruma_OScanner, "skip_until",   og_oniguruma_scanner_skip_until,    1);
+  rb_define_method(og_cOniguruma_OScanner, "check_until",  og_oniguruma_scanner_check_until,   1);
+  rb_define_method(og_cOniguruma_OScanner, "pos",          og_oniguruma_scanner_pos,           0);
+  rb_define_method(og_cOniguruma_OScanner, "pos=",         og_oniguruma_scanner_set_pos,       1);
+  rb_define_method(og_cOniguruma_OScanner, "reset",        og_oniguruma_scanner_reset,         0);
+  rb_define_method(og_cOniguruma_OScanner, "terminate",    og_oniguruma_scanner_terminate,     0);
+  rb_define_method(og_cOniguruma_OScanner, "eos?",         og_oniguruma_scanner_eos_p,         0);
+  rb_define_method(og_cOniguruma_OScanner, "rest",         og_oniguruma_scanner_rest,          0);
+  rb_define_method(og_cOniguruma_OScanner, "string",       og_oniguruma_scanner_string,        0);
+  rb_define_method(og_cOniguruma_OScanner, "string=",      og_oniguruma_scanner_set_string,    1);
+  rb_define_method(og_cOniguruma_OScanner, "matched?",     og_oniguruma_scanner_matched_p,     0);
+  rb_define_method(og_cOniguruma_OScanner, "matched",      og_oniguruma_scanner_matched,       0);
+  rb_define_method(og_cOniguruma_OScanner, "matched_size", og_oniguruma_scanner_matched_size,  0);
+  rb_define_method(og_cOniguruma_OScanner, "[]",           og_oniguruma_scanner_aref,          1);
+  rb_define_method(og_cOniguruma_OScanner, "pre_match",    og_oniguruma_scanner_pre_match,     0);
+  rb_define_method(og_cOniguruma_OScanner, "post_match",   og_oniguruma_scanner_post_match,    0);
+  rb_define_method(og_cOniguruma_OScanner, "omatch",       og_oniguruma_scanner_omatch,        0);
+
+  rb_define_alias(og_cOniguruma_OScanner, "pointer",  "pos");
+  rb_define_alias(og_cOniguruma_OScanner, "pointer=", "pos=");
+}
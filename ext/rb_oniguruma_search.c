@@ -0,0 +1,772 @@
+#include "rb_oniguruma.h"
+#include <sys/time.h>
+#if defined(__SSE2__) && defined(__GNUC__)
+# include <emmintrin.h>
+# define OG_SEARCH_SSE2 1
+#endif
+
+/*
+ * Searches in subjects of at least og_nogvl_threshold bytes run with the
+ * interpreter lock released, so other Ruby threads keep going. The subject
+ * is pinned by a frozen shared copy for the duration, and the search is split
+ * into windows of start positions; between windows the search gives up when
+ * the unblock function has been called, so Thread#raise, Timeout and signals
+ * get through. Programs depending on the search start, and those in
+ * multibyte encodings other than UTF-8, are searched in one window.
+ *
+ * The same windows enforce timeouts: a search with a deadline checks the
+ * clock between windows. The backtracking limit needs the retry limit of
+ * Oniguruma 6.8 and later (onig_search_with_param); there a deadline, or a
+ * search without the lock, also cuts a single slow match attempt into
+ * rounds of retries, doubling each round, and the clock and the unblock
+ * function are checked between rounds. Older versions cannot stop a match
+ * attempt once it has started, nor a search in one window.
+ *
+ * Patterns with a required literal are prefiltered: the subject is scanned
+ * for the literal, 16 bytes at a time where SSE2 is available, and the
+ * engine starts just before its first occurrence, or not at all. Patterns
+ * which are plain strings do not need the engine at all. Both scans run
+ * without the lock as well.
+ */
+static long og_nogvl_threshold = OG_NOGVL_THRESHOLD_DEFAULT;
+static og_SearchLimits og_default_limits = { 0, 0 };
+
+static VALUE og_eOniguruma_MatchTimeout;
+
+/* Only windows of start positions are searched at once */
+#define OG_SEARCH_WINDOW  (256 * 1024)
+#define OG_TIMEOUT_WINDOW (16 * 1024)
+
+/* Retries in the first round of a search with a deadline, some milliseconds */
+#define OG_TIMEOUT_RETRIES (1024 * 1024)
+
+typedef struct og_search_args {
+  og_Program *program;
+  const UChar *str, *end, *start, *range;
+  OnigRegion *region;
+  OnigOptionType option;
+  long window;
+  long match_limit;
+  long retries;             /* retry limit of the current round, 0 for none */
+  int rounds;               /* a round running out is retried, not a failure */
+  double deadline;          /* 0 for none */
+  long found;               /* required literal position, or -1 to look for it */
+  int prepared;             /* the literal was looked for */
+  int result;
+  int finished;
+  volatile int interrupted;
+} og_SearchArgs;
+
+static double
+og_oniguruma_search_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + (double)tv.tv_usec / 1e6;
+}
+
+/* Moves p forward to the next character head */
+static const UChar*
+og_oniguruma_search_char_head(og_Program *program, const UChar *p, const UChar *range)
+{
+  if (program->key.encoding == ONIG_ENCODING_UTF8)
+    while (p < range && (*p & 0xc0) == 0x80)
+      p++;
+  return p;
+}
+
+/*
+ * Returns the first occurrence of needle in haystack, or NULL. The SSE2
+ * version compares the first and the last byte of needle at 16 positions at
+ * once and checks the rest only where both agree.
+ */
+const UChar*
+og_oniguruma_search_literal(const UChar *haystack, long length, const UChar *needle, long needle_length)
+{
+  const UChar *p = haystack, *last = haystack + length - needle_length;
+#ifdef OG_SEARCH_SSE2
+  __m128i first, final, block_first, block_last;
+  unsigned int mask;
+  int bit;
+#endif
+
+  if (needle_length == 0)
+    return haystack;
+  if (needle_length > length)
+    return NULL;
+  if (needle_length == 1)
+    return memchr(haystack, needle[0], length);
+
+#ifdef OG_SEARCH_SSE2
+  first = _mm_set1_epi8((char)needle[0]);
+  final = _mm_set1_epi8((char)needle[needle_length - 1]);
+
+  for (; p + 16 <= last + 1; p += 16) {
+    block_first = _mm_loadu_si128((const __m128i*)p);
+    block_last = _mm_loadu_si128((const __m128i*)(p + needle_length - 1));
+    mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(
+      _mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(final, block_last)));
+
+    while (mask != 0) {
+      bit = __builtin_ctz(mask);
+      if (memcmp(p + bit + 1, needle + 1, needle_length - 2) == 0)
+        return p + bit;
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  while (p <= last) {
+    p = memchr(p, needle[0], last - p + 1);
+    if (p == NULL)
+      return NULL;
+    if (memcmp(p, needle, needle_length) == 0)
+      return p;
+    p++;
+  }
+
+  return NULL;
+}
+
+/* Folds ASCII letters to lower case; mask is 0x20 for letters, 0 otherwise */
+#define og_oniguruma_search_fold_mask(c)  ((((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'z') ? 0x20 : 0)
+#define og_oniguruma_search_fold(c)       ((c) | og_oniguruma_search_fold_mask(c))
+
+static int
+og_oniguruma_search_equal_ic(const UChar *a, const UChar *b, long length)
+{
+  long i;
+
+  for (i = 0; i < length; i++)
+    if (og_oniguruma_search_fold(a[i]) != og_oniguruma_search_fold(b[i]))
+      return 0;
+
+  return 1;
+}
+
+/* og_oniguruma_search_literal ignoring the case of ASCII letters */
+static const UChar*
+og_oniguruma_search_literal_ic(const UChar *haystack, long length, const UChar *needle, long needle_length)
+{
+  const UChar *p = haystack, *last = haystack + length - needle_length;
+  UChar head = og_oniguruma_search_fold(needle[0]);
+#ifdef OG_SEARCH_SSE2
+  __m128i first, first_mask, final, final_mask, block_first, block_last;
+  unsigned int mask;
+  int bit;
+#endif
+
+  if (needle_length > length)
+    return NULL;
+
+#ifdef OG_SEARCH_SSE2
+  first_mask = _mm_set1_epi8((char)og_oniguruma_search_fold_mask(needle[0]));
+  first = _mm_set1_epi8((char)head);
+  final_mask = _mm_set1_epi8((char)og_oniguruma_search_fold_mask(needle[needle_length - 1]));
+  final = _mm_set1_epi8((char)og_oniguruma_search_fold(needle[needle_length - 1]));
+
+  for (; p + 16 <= last + 1; p += 16) {
+    block_first = _mm_or_si128(_mm_loadu_si128((const __m128i*)p), first_mask);
+    block_last = _mm_or_si128(_mm_loadu_si128((const __m128i*)(p + needle_length - 1)), final_mask);
+    mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(
+      _mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(final, block_last)));
+
+    while (mask != 0) {
+      bit = __builtin_ctz(mask);
+      if (og_oniguruma_search_equal_ic(p + bit + 1, needle + 1, needle_length - 1))
+        return p + bit;
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; p <= last; p++)
+    if (og_oniguruma_search_fold(*p) == head && og_oniguruma_search_equal_ic(p + 1, needle + 1, needle_length - 1))
+      return p;
+
+  return NULL;
+}
+
+/*
+ * Searches for a plain string pattern, filling in the region as
+ * onig_search would.
+ */
+static int
+og_oniguruma_search_plain(og_Program *program, const UChar *str, long size, long start, long range,
+  OnigRegion *region)
+{
+  const UChar *found;
+  long length = program->key.length, last = size;
+
+  /* Only occurrences starting up to range count */
+  if (range + length < last)
+    last = range + length;
+  if (last - start < length)
+    return ONIG_MISMATCH;
+
+  if (program->literal_pattern == OG_LITERAL_ICASE)
+    found = og_oniguruma_search_literal_ic(str + start, last - start, program->key.pattern, length);
+  else
+    found = og_oniguruma_search_literal(str + start, last - start, program->key.pattern, length);
+
+  if (found == NULL)
+    return ONIG_MISMATCH;
+
+  if (region != NULL) {
+    if (onig_region_resize(region, 1) != ONIG_NORMAL)
+      return ONIGERR_MEMORY;
+    region->beg[0] = found - str;
+    region->end[0] = found - str + length;
+  }
+
+  return (int)(found - str);
+}
+
+/*
+ * Narrows a forward search from start to the start positions whose match
+ * could contain the first occurrence of the required literal, at byte
+ * found. Returns 0 if no start position is left, so nothing can match.
+ */
+static int
+og_oniguruma_search_narrow(og_Program *program, const UChar *str, long found, long *start, long range)
+{
+  long first;
+
+  /* Moving the start changes what \G matches, and must keep to character heads */
+  if (!program->windowed || program->literal_dmax < 0)
+    return 1;
+
+  first = found - program->literal_dmax;
+  if (first > *start) {
+    if (first > range)
+      return 0;
+    *start = og_oniguruma_search_char_head(program, str + first, str + range) - str;
+  }
+
+  return 1;
+}
+
+/* Looks for the first occurrence of the literal, then narrows as above */
+static int
+og_oniguruma_search_prefilter(og_Program *program, const UChar *str, long length, long *start, long range)
+{
+  const UChar *found;
+  long from = *start + program->literal_dmin;
+
+  if (from > length - program->literal_length)
+    return 0;
+
+  found = og_oniguruma_search_literal(str + from, length - from, program->literal, program->literal_length);
+  if (found == NULL)
+    return 0;
+
+  return og_oniguruma_search_narrow(program, str, found - str, start, range);
+}
+
+/*
+ * Narrows a forward search by the required literal, at byte found or
+ * looked for when found is -1, or searches a plain string pattern outright.
+ * Returns non-zero when that settles the search, with its result in
+ * *result.
+ */
+static int
+og_oniguruma_search_prepare(og_Program *program, const UChar *str, long length, long *start, long range,
+  OnigRegion *region, long found, int *result)
+{
+  *result = ONIG_MISMATCH;
+
+  if (found >= 0 && program->literal != NULL && !og_oniguruma_search_narrow(program, str, found, start, range))
+    return 1;
+
+  if (program->literal_pattern != OG_LITERAL_NONE) {
+    *result = og_oniguruma_search_plain(program, str, length, *start, range, region);
+    return 1;
+  }
+
+  if (found < 0 && program->literal != NULL && !og_oniguruma_search_prefilter(program, str, length, start, range))
+    return 1;
+
+  return 0;
+}
+
+static void*
+og_oniguruma_search_nogvl(void *data)
+{
+  long start;
+  const UChar *window;
+  og_SearchArgs *args = (og_SearchArgs*)data;
+#ifdef HAVE_ONIG_SEARCH_WITH_PARAM
+  OnigMatchParam *param = NULL;
+#endif
+
+  /* The literal scan may cover the whole subject, so it runs here too */
+  if (!args->prepared) {
+    args->prepared = 1;
+    start = args->start - args->str;
+    if (og_oniguruma_search_prepare(args->program, args->str, args->end - args->str, &start,
+          args->range - args->str, args->region, args->found, &args->result)) {
+      args->finished = 1;
+      return NULL;
+    }
+    args->start = args->str + start;
+  }
+
+#ifdef HAVE_ONIG_SEARCH_WITH_PARAM
+
+  if (args->retries > 0) {
+    param = onig_new_match_param();
+    onig_initialize_match_param(param);
+  }
+#endif
+
+  while (!args->interrupted) {
+    window = args->range;
+    if (args->program->windowed && args->range - args->start > args->window)
+      window = og_oniguruma_search_char_head(args->program, args->start + args->window, args->range);
+
+#ifdef HAVE_ONIG_SEARCH_WITH_PARAM
+    if (param != NULL)
+      onig_set_retry_limit_in_match_of_match_param(param, (unsigned long)args->retries);
+    if (param != NULL)
+      args->result = onig_search_with_param(args->program->reg, (UChar*)args->str, (UChar*)args->end,
+        (UChar*)args->start, (UChar*)window, args->region, args->option, param);
+    else
+#endif
+    args->result = onig_search(args->program->reg, (UChar*)args->str, (UChar*)args->end,
+      (UChar*)args->start, (UChar*)window, args->region, args->option);
+
+#ifdef ONIGERR_RETRY_LIMIT_IN_MATCH_OVER
+    /*
+     * A round ran out: unless interrupted or past the deadline, go again
+     * from the same window with twice the retries
+     */
+    if (args->result == ONIGERR_RETRY_LIMIT_IN_MATCH_OVER && args->rounds &&
+        (args->match_limit == 0 || args->retries < args->match_limit) &&
+        (args->deadline == 0 || og_oniguruma_search_now() < args->deadline)) {
+      args->retries = args->retries > LONG_MAX / 2 ? LONG_MAX : args->retries * 2;
+      if (args->match_limit > 0 && args->retries > args->match_limit)
+        args->retries = args->match_limit;
+      continue;
+    }
+
+    if (args->result == ONIGERR_RETRY_LIMIT_IN_MATCH_OVER)
+      args->result = OG_SEARCH_TIMEOUT;
+#endif
+
+    /* Every earlier start position failed, so a match here is the first one */
+    if (args->result != ONIG_MISMATCH || window == args->range) {
+      args->finished = 1;
+      break;
+    }
+
+    args->start = window;
+
+    if (args->deadline > 0 && og_oniguruma_search_now() >= args->deadline) {
+      args->result = OG_SEARCH_TIMEOUT;
+      args->finished = 1;
+      break;
+    }
+  }
+
+#ifdef HAVE_ONIG_SEARCH_WITH_PARAM
+  if (param != NULL)
+    onig_free_match_param(param);
+#endif
+
+  return NULL;
+}
+
+static void
+og_oniguruma_search_ubf(void *data)
+{
+  ((og_SearchArgs*)data)->interrupted = 1;
+}
+
+/*
+ * onig_search over the length bytes at str, after the plain string search
+ * or the prefilter, with no limits. Touches nothing of the interpreter, so
+ * it may run on native threads.
+ */
+int
+og_oniguruma_search_native(og_Program *program, const UChar *str, long length, long start, long range,
+  OnigRegion *region, OnigOptionType option)
+{
+  int result;
+
+  if (start <= range && og_oniguruma_search_prepare(program, str, length, &start, range, region, -1, &result))
+    return result;
+
+  return onig_search(program->reg, (UChar*)str, (UChar*)str + length,
+    (UChar*)str + start, (UChar*)str + range, region, option);
+}
+
+/*
+ * og_oniguruma_search_bytes; found is the byte offset of the first
+ * occurrence of the required literal at or after start, or -1 to look for
+ * it.
+ */
+static int
+og_oniguruma_search_run(og_Program *program, const UChar *str, long length, long start, long range,
+  OnigRegion *region, OnigOptionType option, const og_SearchLimits *limits, long found)
+{
+  int result;
+  og_SearchArgs args;
+  long match_limit = og_default_limits.match_limit;
+  double timeout = og_default_limits.timeout;
+  int locked = length < og_nogvl_threshold;
+
+  if (limits != NULL && limits->match_limit >= 0) match_limit = limits->match_limit;
+  if (limits != NULL && limits->timeout >= 0)     timeout = limits->timeout;
+
+  if (range < start)
+    return og_oniguruma_search_native(program, str, length, start, range, region, option);
+
+  if (locked && match_limit == 0 && timeout == 0) {
+    if (og_oniguruma_search_prepare(program, str, length, &start, range, region, found, &result))
+      return result;
+    return onig_search(program->reg, (UChar*)str, (UChar*)str + length,
+      (UChar*)str + start, (UChar*)str + range, region, option);
+  }
+
+  args.program = program;
+  args.str = str;
+  args.end = str + length;
+  args.start = str + start;
+  args.range = str + range;
+  args.region = region;
+  args.option = option;
+  args.window = timeout > 0 ? OG_TIMEOUT_WINDOW : OG_SEARCH_WINDOW;
+  args.match_limit = match_limit;
+  args.retries = match_limit;
+  args.rounds = 0;
+#ifdef HAVE_ONIG_SEARCH_WITH_PARAM
+  /* Rounds of retries let a deadline, or an interrupt, stop a single slow attempt */
+  args.rounds = timeout > 0 || !locked;
+  if (args.rounds && (match_limit == 0 || match_limit > OG_TIMEOUT_RETRIES))
+    args.retries = OG_TIMEOUT_RETRIES;
+#endif
+  args.deadline = timeout > 0 ? og_oniguruma_search_now() + timeout : 0;
+  args.found = found;
+  args.prepared = 0;
+  args.interrupted = 0;
+  args.finished = 0;
+
+  if (locked) {
+    og_oniguruma_search_nogvl(&args);
+    return args.result;
+  }
+
+  do {
+    args.interrupted = 0;
+    og_oniguruma_without_gvl(og_oniguruma_search_nogvl, &args, og_oniguruma_search_ubf, &args);
+
+    /* Raises if the interrupt was for us, otherwise carry on searching */
+    if (!args.finished)
+      og_oniguruma_check_ints();
+  } while (!args.finished);
+
+  return args.result;
+}
+
+/*
+ * onig_search over the length bytes at str, trying match starts from start
+ * up to range; large subjects are searched without the interpreter lock, so
+ * the bytes must stay in place meanwhile. limits may be NULL for the
+ * defaults. Returns the match position, ONIG_MISMATCH, OG_SEARCH_TIMEOUT or
+ * an Oniguruma error code.
+ */
+int
+og_oniguruma_search_bytes(og_Program *program, const UChar *str, long length, long start, long range,
+  OnigRegion *region, OnigOptionType option, const og_SearchLimits *limits)
+{
+  return og_oniguruma_search_run(program, str, length, start, range, region, option, limits, -1);
+}
+
+/* og_oniguruma_search_bytes over the contents of string */
+int
+og_oniguruma_search_string(og_Program *program, VALUE string, long start, long range,
+  OnigRegion *region, OnigOptionType option, const og_SearchLimits *limits)
+{
+  int result;
+  volatile VALUE pinned = string;
+
+  /* Other threads may modify string meanwhile; the copy keeps its buffer */
+  if (RSTRING_LEN(string) >= og_nogvl_threshold)
+    pinned = rb_str_new4(string);
+
+  result = og_oniguruma_search_bytes(program, OG_STRING_PTR(pinned), RSTRING_LEN(pinned),
+    start, range, region, option, limits);
+
+  return result;
+}
+
+/*
+ * og_oniguruma_search_string over all of string, when the caller already
+ * found the first occurrence of the required literal, at byte found; the
+ * subject is not scanned for it again. found is -1 when the program has no
+ * required literal.
+ */
+int
+og_oniguruma_search_string_found(og_Program *program, VALUE string, long found,
+  OnigRegion *region, OnigOptionType option, const og_SearchLimits *limits)
+{
+  int result;
+  volatile VALUE pinned = string;
+
+  if (RSTRING_LEN(string) >= og_nogvl_threshold)
+    pinned = rb_str_new4(string);
+
+  result = og_oniguruma_search_run(program, OG_STRING_PTR(pinned), RSTRING_LEN(pinned),
+    0, RSTRING_LEN(pinned), region, option, limits, found);
+
+  return result;
+}
+
+/* Raises the exception for a failed search */
+void
+og_oniguruma_search_error(int result)
+{
+  UChar error_string[ONIG_MAX_ERROR_MESSAGE_LEN];
+
+  if (result == OG_SEARCH_TIMEOUT)
+    rb_raise(og_eOniguruma_MatchTimeout, "match limit or timeout exceeded");
+#ifdef ONIGERR_RETRY_LIMIT_IN_MATCH_OVER
+  /* Oniguruma's own default retry limit */
+  if (result == ONIGERR_RETRY_LIMIT_IN_MATCH_OVER)
+    rb_raise(og_eOniguruma_MatchTimeout, "match limit exceeded");
+#endif
+
+  onig_error_code_to_str(error_string, result);
+  rb_raise(rb_eArgError, OG_M_ONIGURUMA " Error: %s", error_string);
+}
+
+/* Whether matches may depend on where the search starts: \G, longest match */
+int
+og_oniguruma_search_start_dependent(const og_PatternKey *key)
+{
+  long i;
+
+  if (key->options & ONIG_OPTION_FIND_LONGEST)
+    return 1;
+
+  for (i = 0; i + 1 < key->length; i++)
+    if (key->pattern[i] == '\\' && key->pattern[i + 1] == 'G')
+      return 1;
+
+  return 0;
+}
+
+/*
+ * Whether the pattern is a plain string: no metacharacters, no options
+ * changing how it reads, and an encoding in which a byte match is a
+ * character match. Ignoring case, only ASCII patterns qualify, and in UTF-8
+ * none with f, k or s, which also match characters such as U+212A (Kelvin)
+ * and the ligatures and sharp s folding to ff, fi, st or ss.
+ */
+int
+og_oniguruma_search_literal_pattern(const og_PatternKey *key)
+{
+  long i;
+  OnigOptionType options = key->options | key->syntax->options;
+  OnigOptionType plain = ONIG_OPTION_IGNORECASE | ONIG_OPTION_MULTILINE | ONIG_OPTION_SINGLELINE |
+    ONIG_OPTION_NEGATE_SINGLE_LINE | ONIG_OPTION_CAPTURE_GROUP | ONIG_OPTION_DONT_CAPTURE_GROUP;
+  static const char metachars[] = "\\^$.|?*+()[]{}";
+
+  if (key->length == 0 || (options & ~plain) != 0)
+    return OG_LITERAL_NONE;
+  if (ONIGENC_MBC_MAXLEN(key->encoding) != 1 && key->encoding != ONIG_ENCODING_UTF8)
+    return OG_LITERAL_NONE;
+
+  for (i = 0; i < key->length; i++)
+    if (memchr(metachars, key->pattern[i], sizeof(metachars) - 1) != NULL)
+      return OG_LITERAL_NONE;
+
+  if (!(options & ONIG_OPTION_IGNORECASE))
+    return OG_LITERAL_EXACT;
+  if (key->encoding != ONIG_ENCODING_ASCII && key->encoding != ONIG_ENCODING_UTF8)
+    return OG_LITERAL_NONE;
+
+  for (i = 0; i < key->length; i++) {
+    if (key->pattern[i] >= 0x80)
+      return OG_LITERAL_NONE;
+    if (key->encoding == ONIG_ENCODING_UTF8 && memchr("fkFKsS", key->pattern[i], 6) != NULL)
+      return OG_LITERAL_NONE;
+  }
+
+  return OG_LITERAL_ICASE;
+}
+
+/* Windows may not change what matches, and must end at character heads */
+int
+og_oniguruma_search_windowed(const og_PatternKey *key)
+{
+  if (ONIGENC_MBC_MAXLEN(key->encoding) != 1 && key->encoding != ONIG_ENCODING_UTF8)
+    return 0;
+
+  return !og_oniguruma_search_start_dependent(key);
+}
+
+static long
+og_oniguruma_search_match_limit(VALUE value)
+{
+  long match_limit = NUM2LONG(value);
+
+  if (match_limit < 0)
+    rb_raise(rb_eArgError, "negative match limit");
+#ifndef HAVE_ONIG_SEARCH_WITH_PARAM
+  if (match_limit > 0)
+    rb_raise(rb_eNotImpError, "match_limit needs Oniguruma 6.8 or later");
+#endif
+
+  return match_limit;
+}
+
+static double
+og_oniguruma_search_timeout(VALUE value)
+{
+  double timeout = NUM2DBL(value);
+
+  if (timeout < 0)
+    rb_raise(rb_eArgError, "negative timeout");
+
+  return timeout;
+}
+
+/* Sets the :match_limit and :timeout given in hash */
+void
+og_oniguruma_search_limits_parse(og_SearchLimits *limits, VALUE hash)
+{
+  VALUE match_limit, timeout;
+
+  match_limit = rb_hash_aref(hash, ID2SYM(rb_intern("match_limit")));
+  timeout     = rb_hash_aref(hash, ID2SYM(rb_intern("timeout")));
+
+  if (!NIL_P(match_limit)) limits->match_limit = og_oniguruma_search_match_limit(match_limit);
+  if (!NIL_P(timeout))     limits->timeout = og_oniguruma_search_timeout(timeout);
+}
+
+/*
+ * Document-method: nogvl_threshold
+ *
+ * call-seq:
+ *    ORegexp.nogvl_threshold   => int
+ *
+ * Returns the subject size, in bytes, from which searches release the
+ * interpreter lock.
+ */
+static VALUE
+og_oniguruma_search_threshold(VALUE self)
+{
+  return LONG2NUM(og_nogvl_threshold);
+}
+
+/*
+ * Document-method: nogvl_threshold=
+ *
+ * call-seq:
+ *    ORegexp.nogvl_threshold = int
+ *
+ * Sets the subject size, in bytes, from which searches release the
+ * interpreter lock so other threads can run meanwhile. Smaller subjects are
+ * searched faster with the lock held.
+ *
+ * Without the lock, <code>Thread#raise</code>, <code>Timeout</code> and
+ * signals stop a search between windows of start positions, and with
+ * Oniguruma 6.8 or later also within a single slow match attempt. Older
+ * versions cannot interrupt a match attempt, nor a search whose pattern
+ * uses <code>\G</code> or <code>OPTION_FIND_LONGEST</code>, or whose
+ * encoding is multibyte other than UTF-8: these are searched in one window,
+ * and an interrupt waits until the search ends.
+ */
+static VALUE
+og_oniguruma_search_set_threshold(VALUE self, VALUE threshold)
+{
+  long bytes = NUM2LONG(threshold);
+
+  if (bytes < 0)
+    rb_raise(rb_eArgError, "negative threshold");
+
+  og_nogvl_threshold = bytes;
+  return threshold;
+}
+
+/*
+ * Document-method: default_match_limit
+ *
+ * call-seq:
+ *    ORegexp.default_match_limit   => int
+ *
+ * Returns the backtracking limit of regexps created without
+ * <code>:match_limit</code>; 0 means unlimited.
+ */
+static VALUE
+og_oniguruma_search_default_match_limit(VALUE self)
+{
+  return LONG2NUM(og_default_limits.match_limit);
+}
+
+/*
+ * Document-method: default_match_limit=
+ *
+ * call-seq:
+ *    ORegexp.default_match_limit = int
+ *
+ * Sets the number of backtracking steps a match attempt may take before
+ * <code>Oniguruma::MatchTimeout</code> is raised, for regexps created
+ * without <code>:match_limit</code>. Needs Oniguruma 6.8 or later.
+ */
+static VALUE
+og_oniguruma_search_set_default_match_limit(VALUE self, VALUE match_limit)
+{
+  og_default_limits.match_limit = NIL_P(match_limit) ? 0 : og_oniguruma_search_match_limit(match_limit);
+  return match_limit;
+}
+
+/*
+ * Document-method: default_timeout
+ *
+ * call-seq:
+ *    ORegexp.default_timeout   => float
+ *
+ * Returns the timeout, in seconds, of regexps created without
+ * <code>:timeout</code>; 0 means none.
+ */
+static VALUE
+og_oniguruma_search_default_timeout(VALUE self)
+{
+  return rb_float_new(og_default_limits.timeout);
+}
+
+/*
+ * Document-method: default_timeout=
+ *
+ * call-seq:
+ *    ORegexp.default_timeout = secs
+ *
+ * Sets the time a search may take before
+ * <code>Oniguruma::MatchTimeout</code> is raised, for regexps created
+ * without <code>:timeout</code>. The clock is checked between windows of
+ * 16K start positions and, with Oniguruma 6.8 and later, between rounds of
+ * retries within a match attempt, so a catastrophic pattern on a short
+ * subject is stopped too. Older versions cannot cut a single very slow
+ * match attempt short.
+ */
+static VALUE
+og_oniguruma_search_set_default_timeout(VALUE self, VALUE timeout)
+{
+  og_default_limits.timeout = NIL_P(timeout) ? 0 : og_oniguruma_search_timeout(timeout);
+  return timeout;
+}
+
+void
+og_oniguruma_search(VALUE mod, VALUE klass)
+{
+  og_eOniguruma_MatchTimeout = rb_define_class_under(mod, "MatchTimeout", rb_eRuntimeError);
+
+  rb_define_singleton_method(klass, "nogvl_threshold",       og_oniguruma_search_threshold,                0);
+  rb_define_singleton_method(klass, "nogvl_threshold=",      og_oniguruma_search_set_threshold,            1);
+  rb_define_singleton_method(klass, "default_match_limit",   og_oniguruma_search_default_match_limit,      0);
+  rb_define_singleton_method(klass, "default_match_limit=",  og_oniguruma_search_set_default_match_limit,  1);
+  rb_define_singleton_method(klass, "default_timeout",       og_oniguruma_search_default_timeout,          0);
+  rb_define_singleton_method(klass, "default_timeout=",      og_oniguruma_search_set_default_timeout,      1);
+}
@@ -0,0 +1,392 @@
+#include "rb_oniguruma.h"
+
+/*
+ * ORegexp::Set runs a subject against many patterns at once. A match is a
+ * linear pass over the patterns; there is no index of them. Every pattern
+ * with a required literal ("atom", as chosen by the optimizer) is only
+ * searched when its atom occurs in the subject, and then from where the
+ * atom was found. For a large set and a long enough subject the atoms are
+ * screened with a bitmap of the byte pairs in the subject before being
+ * looked for, so most patterns cost a few bit tests per subject. Building
+ * the bitmap costs a pass over the subject and clearing 8K, which a few
+ * atoms or a short subject do not make up for; their atoms are looked for
+ * directly.
+ *
+ * A set never changes after initialize, so it can be shared between threads.
+ */
+#ifndef OG_SET_SCREEN_MIN_ATOMS
+#define OG_SET_SCREEN_MIN_ATOMS 16
+#endif
+
+/* Bytes of atom lookups (atoms times subject length) worth a screen */
+#ifndef OG_SET_SCREEN_MIN_WORK
+#define OG_SET_SCREEN_MIN_WORK  (64 * 1024)
+#endif
+
+typedef struct og_set_entry {
+  VALUE oregexp;
+  const UChar *atom;        /* points into the compiled program, or NULL */
+  long atom_length;
+} og_SetEntry;
+
+typedef struct og_oregexp_set {
+  VALUE patterns;           /* frozen Array of the ORegexp objects */
+  long count;
+  long atoms;               /* entries with an atom */
+  og_SetEntry *entries;
+} og_ORegexpSet;
+
+/* Byte pairs and single bytes present in a subject */
+typedef struct og_set_screen {
+  unsigned char pairs[65536 / 8];
+  unsigned char bytes[256 / 8];
+} og_SetScreen;
+
+#define og_oniguruma_set_bit(map, i)      ((map)[(i) >> 3] |= (1 << ((i) & 7)))
+#define og_oniguruma_set_bit_p(map, i)    ((map)[(i) >> 3] & (1 << ((i) & 7)))
+#define og_oniguruma_set_pair(p)          (((unsigned)(p)[0] << 8) | (p)[1])
+
+static VALUE og_cOniguruma_ORegexp;
+
+static void
+og_oniguruma_set_mark(void *arg)
+{
+  og_ORegexpSet *set = (og_ORegexpSet*)arg;
+  rb_gc_mark(set->patterns);
+}
+
+static void
+og_oniguruma_set_free(void *arg)
+{
+  og_ORegexpSet *set = (og_ORegexpSet*)arg;
+  free(set->entries);
+  free(set);
+}
+
+static VALUE
+og_oniguruma_set_alloc(VALUE klass)
+{
+  og_ORegexpSet *set;
+
+  set = malloc(sizeof(og_ORegexpSet));
+  set->patterns = Qnil;
+  set->count = 0;
+  set->atoms = 0;
+  set->entries = NULL;
+
+  return Data_Wrap_Struct(klass, og_oniguruma_set_mark, og_oniguruma_set_free, set);
+}
+
+/*
+ * Document-method: new
+ *
+ * call-seq:
+ *    ORegexp::Set.new(patterns, options_hash=nil)
+ *
+ * Builds a set from an Array of ORegexp objects and pattern Strings; the
+ * Strings are compiled with <i>options_hash</i>, as for
+ * <code>ORegexp.new</code>. All patterns are compiled, and their atoms
+ * looked up, up front.
+ *
+ *    rules = ORegexp::Set.new(['union\s+select', '<script', 'etc/passwd'],
+ *                             :options => Oniguruma::OPTION_IGNORECASE)
+ */
+static VALUE
+og_oniguruma_set_initialize(int argc, VALUE *argv, VALUE self)
+{
+  long i;
+  regex_t *reg;
+  og_ORegexpSet *set;
+  og_SetEntry *entry;
+  VALUE list, options, item, patterns, args[2];
+
+  rb_scan_args(argc, argv, "11", &list, &options);
+
+  Data_Get_Struct(self, og_ORegexpSet, set);
+  if (!NIL_P(set->patterns))
+    rb_raise(rb_eTypeError, "already initialized set");
+
+  list = rb_Array(list);
+  patterns = rb_ary_new2(RARRAY_LEN(list));
+
+  for (i = 0; i < RARRAY_LEN(list); i++) {
+    item = rb_ary_entry(list, i);
+
+    if (!rb_obj_is_kind_of(item, og_cOniguruma_ORegexp)) {
+      args[0] = item;
+      args[1] = NIL_P(options) ? rb_hash_new() : options;
+      item = rb_class_new_instance(2, args, og_cOniguruma_ORegexp);
+    }
+
+    rb_ary_push(patterns, item);
+  }
+
+  free(set->entries);
+  set->entries = malloc((RARRAY_LEN(patterns) + 1) * sizeof(og_SetEntry));
+  set->atoms = 0;
+
+  for (i = 0; i < RARRAY_LEN(patterns); i++) {
+    entry = &set->entries[i];
+    entry->oregexp = rb_ary_entry(patterns, i);
+
+    reg = og_oniguruma_oregexp_reg(entry->oregexp);
+    if (!og_oniguruma_required_literal(reg, &entry->atom, &entry->atom_length))
+      entry->atom = NULL;
+    else
+      set->atoms++;
+  }
+
+  set->count = RARRAY_LEN(patterns);
+  set->patterns = rb_obj_freeze(patterns);
+
+  return self;
+}
+
+static void
+og_oniguruma_set_screen(og_SetScreen *screen, const UChar *str, long length)
+{
+  long i;
+
+  memset(screen, 0, sizeof(og_SetScreen));
+
+  for (i = 0; i < length; i++) {
+    og_oniguruma_set_bit(screen->bytes, str[i]);
+    if (i + 1 < length)
+      og_oniguruma_set_bit(screen->pairs, og_oniguruma_set_pair(str + i));
+  }
+}
+
+/* Whether screening the atoms of set pays off for a subject of length bytes */
+static int
+og_oniguruma_set_screen_p(og_ORegexpSet *set, long length)
+{
+  return set->atoms >= OG_SET_SCREEN_MIN_ATOMS &&
+    length >= OG_SET_SCREEN_MIN_WORK / set->atoms;
+}
+
+/*
+ * Returns non-zero if entry is worth searching: it has no atom, or its atom
+ * occurs in the subject, at *found; -1 there without an atom. Without a
+ * screen the atom is looked for directly.
+ */
+static int
+og_oniguruma_set_candidate(og_SetEntry *entry, og_SetScreen *screen, const UChar *str, long length,
+  long *found)
+{
+  long i;
+  const UChar *atom;
+
+  *found = -1;
+  if (entry->atom == NULL)
+    return 1;
+  if (entry->atom_length > length)
+    return 0;
+
+  if (screen != NULL) {
+    if (entry->atom_length == 1 && !og_oniguruma_set_bit_p(screen->bytes, entry->atom[0]))
+      return 0;
+    for (i = 0; i + 1 < entry->atom_length; i++)
+      if (!og_oniguruma_set_bit_p(screen->pairs, og_oniguruma_set_pair(entry->atom + i)))
+        return 0;
+  }
+
+  atom = og_oniguruma_search_literal(str, length, entry->atom, entry->atom_length);
+  if (atom == NULL)
+    return 0;
+
+  *found = atom - str;
+  return 1;
+}
+
+/*
+ * Calls found(index, data) for every matching pattern in order, stopping
+ * when it returns zero.
+ */
+static void
+og_oniguruma_set_each_match(VALUE self, VALUE string, int (*found)(long, void*), void *data)
+{
+  long i, length, atom;
+  int result;
+  const UChar *str;
+  og_ORegexpSet *set;
+  og_ORegexp *oregexp;
+  og_SetScreen screen, *screened = NULL;
+  volatile VALUE subject;
+
+  Data_Get_Struct(self, og_ORegexpSet, set);
+
+  /* Searches may release the interpreter lock; keep the bytes in place */
+  subject = rb_str_new4(StringValue(string));
+  str = OG_STRING_PTR(subject);
+  length = RSTRING_LEN(subject);
+
+  if (og_oniguruma_set_screen_p(set, length)) {
+    og_oniguruma_set_screen(&screen, str, length);
+    screened = &screen;
+  }
+
+  for (i = 0; i < set->count; i++) {
+    if (!og_oniguruma_set_candidate(&set->entries[i], screened, str, length, &atom))
+      continue;
+
+    /* The atom is the required literal of the program; it is not looked for twice */
+    Data_Get_Struct(set->entries[i].oregexp, og_ORegexp, oregexp);
+    result = og_oniguruma_search_string_found(oregexp->program, subject, atom,
+      NULL, ONIG_OPTION_NONE, &oregexp->limits);
+
+    if (result == ONIG_MISMATCH)
+      continue;
+    if (result < 0)
+      og_oniguruma_search_error(result);
+    if (!found(i, data))
+      break;
+  }
+}
+
+static int
+og_oniguruma_set_collect(long index, void *data)
+{
+  rb_ary_push(*(VALUE*)data, LONG2NUM(index));
+  return 1;
+}
+
+static int
+og_oniguruma_set_stop(long index, void *data)
+{
+  *(long*)data = index;
+  return 0;
+}
+
+/*
+ * Document-method: matches
+ *
+ * call-seq:
+ *    set.matches(str)   => array
+ *
+ * Returns the indices of all patterns matching <i>str</i>, in ascending
+ * order. Every pattern is checked in turn, but only patterns without an
+ * atom, or whose atom occurs in <i>str</i>, are searched.
+ *
+ *    rules.matches('id=1 UNION  SELECT pw')   #=> [0]
+ */
+static VALUE
+og_oniguruma_set_matches(VALUE self, VALUE string)
+{
+  VALUE indices = rb_ary_new();
+  og_oniguruma_set_each_match(self, string, og_oniguruma_set_collect, &indices);
+  return indices;
+}
+
+/*
+ * Document-method: match?
+ *
+ * call-seq:
+ *    set.match?(str)   => true or false
+ *
+ * Returns whether any pattern matches <i>str</i>, stopping at the first.
+ */
+static VALUE
+og_oniguruma_set_match_p(VALUE self, VALUE string)
+{
+  long index = -1;
+  og_oniguruma_set_each_match(self, string, og_oniguruma_set_stop, &index);
+  return index >= 0 ? Qtrue : Qfalse;
+}
+
+/*
+ * Document-method: index
+ *
+ * call-seq:
+ *    set.index(str)   => int or nil
+ *
+ * Returns the index of the first pattern matching <i>str</i>, or
+ * <code>nil</code>.
+ */
+static VALUE
+og_oniguruma_set_index(VALUE self, VALUE string)
+{
+  long index = -1;
+  og_oniguruma_set_each_match(self, string, og_oniguruma_set_stop, &index);
+  return index >= 0 ? LONG2NUM(index) : Qnil;
+}
+
+/*
+ * Document-method: patterns
+ *
+ * call-seq:
+ *    set.patterns   => array
+ *
+ * Returns the frozen Array of the ORegexp objects in the set.
+ */
+static VALUE
+og_oniguruma_set_patterns(VALUE self)
+{
+  og_ORegexpSet *set;
+
+  Data_Get_Struct(self, og_ORegexpSet, set);
+  return set->patterns;
+}
+
+/*
+ * Document-method: size
+ *
+ * call-seq:
+ *    set.size   => int
+ */
+static VALUE
+og_oniguruma_set_size(VALUE self)
+{
+  og_ORegexpSet *set;
+
+  Data_Get_Struct(self, og_ORegexpSet, set);
+  return LONG2NUM(set->count);
+}
+
+/*
+ * Document-method: atoms
+ *
+ * call-seq:
+ *    set.atoms   => array
+ *
+ * Returns the atom of every pattern, or <code>nil</code> for patterns which
+ * are searched for every subject.
+ */
+static VALUE
+og_oniguruma_set_atoms(VALUE self)
+{
+  long i;
+  VALUE atoms;
+  og_ORegexpSet *set;
+
+  Data_Get_Struct(self, og_ORegexpSet, set);
+
+  atoms = rb_ary_new2(set->count);
+  for (i = 0; i < set->count; i++) {
+    if (set->entries[i].atom == NULL)
+      rb_ary_push(atoms, Qnil);
+    else
+      rb_ary_push(atoms, rb_str_new((char*)set->entries[i].atom, set->entries[i].atom_length));
+  }
+
+  return atoms;
+}
+
+void
+og_oniguruma_set(VALUE klass)
+{
+  VALUE og_cOniguruma_ORegexp_Set;
+
+  og_cOniguruma_ORegexp = klass;
+  og_cOniguruma_ORegexp_Set = rb_define_class_under(klass, "Set", rb_cObject);
+  rb_define_alloc_func(og_cOniguruma_ORegexp_Set, og_oniguruma_set_alloc);
+
+  rb_define_method(og_cOniguruma_ORegexp_Set, "initialize",  og_oniguruma_set_initialize,  -1);
+  rb_define_method(og_cOniguruma_ORegexp_Set, "matches",     og_oniguruma_set_matches,      1);
+  rb_define_method(og_cOniguruma_ORegexp_Set, "match?",      og_oniguruma_set_match_p,      1);
+  rb_define_method(og_cOniguruma_ORegexp_Set, "index",       og_oniguruma_set_index,        1);
+  rb_define_method(og_cOniguruma_ORegexp_Set, "patterns",    og_oniguruma_set_patterns,     0);
+  rb_define_method(og_cOniguruma_ORegexp_Set, "size",        og_oniguruma_set_size,         0);
+  rb_define_method(og_cOniguruma_ORegexp_Set, "atoms",       og_oniguruma_set_atoms,        0);
+
+  rb_define_alias(og_cOniguruma_ORegexp_Set, "length", "size");
+}
@@ -0,0 +1,409 @@
+#include "rb_oniguruma.h"
+#include "rb_oniguruma_match.h"
+
+/*
+ * Scanning of IO streams. The stream is read in chunks into a buffer
+ * holding the unresolved tail of the previous chunks and the new one. A
+ * start position is resolved once max_match bytes follow it, since no
+ * match, look-around included, may be longer; the buffer therefore never
+ * keeps more than max_match bytes before the first unresolved position,
+ * which serve as look-behind context.
+ *
+ * The buffer start is not the beginning of a line unless it is the start of
+ * the stream (ONIG_OPTION_NOTBOL), and its end is not the end of a line
+ * unless the stream has ended (ONIG_OPTION_NOTEOL).
+ *
+ * grep_lines works on whole lines instead: every line is searched as a
+ * subject of its own, and lines which lack the required literal of the
+ * pattern are passed over without starting the engine.
+ */
+#ifndef OG_STREAM_CHUNK_DEFAULT
+#define OG_STREAM_CHUNK_DEFAULT     (1024 * 1024)
+#endif
+
+#ifndef OG_STREAM_MAX_MATCH_DEFAULT
+#define OG_STREAM_MAX_MATCH_DEFAULT (64 * 1024)
+#endif
+
+typedef struct og_stream_args {
+  VALUE self;
+  VALUE io;
+  long chunk;
+  long max_match;
+  og_SearchLimits limits;
+  OnigRegion *region;
+} og_StreamArgs;
+
+typedef struct og_grep_args {
+  VALUE input;              /* String or IO */
+  long chunk;               /* bytes read from an IO at a time */
+  og_Program *program;
+  og_SearchLimits limits;
+  int invert;
+  int count_only;
+  long line;                /* number of the next line, from 1 */
+  long count;
+  VALUE results;            /* Array, or nil with a block */
+} og_GrepArgs;
+
+static ID og_id_read;
+
+static long
+og_oniguruma_stream_size(VALUE options, const char *name, long fallback)
+{
+  long size;
+  VALUE value;
+
+  if (NIL_P(options))
+    return fallback;
+
+  value = rb_hash_aref(options, ID2SYM(rb_intern(name)));
+  if (NIL_P(value))
+    return fallback;
+
+  size = NUM2LONG(value);
+  if (size <= 0)
+    rb_raise(rb_eArgError, "%s must be positive", name);
+  return size;
+}
+
+/* Aligns position p of buffer str back to a character head */
+static long
+og_oniguruma_stream_char_head(OnigEncoding encoding, const UChar *str, long p)
+{
+  return onigenc_get_left_adjust_char_head(encoding, str, str + p) - str;
+}
+
+/*
+ * Yields an OMatch over a copy of the text spanned by the groups of region,
+ * found in buffer, together with the stream offset of the match.
+ */
+static void
+og_oniguruma_stream_yield(og_ORegexp *oregexp, OnigRegion *region, VALUE buffer, long offset)
+{
+  int i;
+  long low = region->beg[0], high = region->end[0];
+  VALUE text, omatch;
+
+  for (i = 1; i < region->num_regs; i++) {
+    if (region->beg[i] < 0)
+      continue;
+    if (region->beg[i] < low)  low = region->beg[i];
+    if (region->end[i] > high) high = region->end[i];
+  }
+
+  text = rb_str_new(RSTRING_PTR(buffer) + low, high - low);
+  offset += region->beg[0];
+
+  for (i = 0; i < region->num_regs; i++) {
+    if (region->beg[i] < 0)
+      continue;
+    region->beg[i] -= low;
+    region->end[i] -= low;
+  }
+
+  omatch = og_oniguruma_omatch_new(region, text, oregexp->names);
+  rb_yield_values(2, omatch, LONG2NUM(offset));
+}
+
+static VALUE
+og_oniguruma_stream_do_scan(og_StreamArgs *args)
+{
+  int result, eof = 0;
+  long count = 0, offset = 0, keep = 0, resume = 0, limit, length, end;
+  const UChar *str;
+  OnigEncoding encoding;
+  OnigOptionType option;
+  og_ORegexp *oregexp;
+  volatile VALUE buffer, data, chunk;
+
+  og_oniguruma_oregexp_reg(args->self);
+  Data_Get_Struct(args->self, og_ORegexp, oregexp);
+  encoding = oregexp->key.encoding;
+
+  buffer = rb_str_new(0, 0);
+  chunk = rb_str_new(0, 0);
+
+  while (!eof) {
+    data = rb_funcall(args->io, og_id_read, 2, LONG2NUM(args->chunk), chunk);
+
+    if (NIL_P(data)) {
+      eof = 1;
+    } else {
+      /* Drop what is resolved, keeping the look-behind context */
+      length = RSTRING_LEN(buffer) - keep;
+      data = rb_str_buf_new(length + RSTRING_LEN(data));
+      rb_str_buf_cat(data, RSTRING_PTR(buffer) + keep, length);
+      rb_str_buf_append(data, chunk);
+
+      buffer = data;
+      offset += keep;
+      resume -= keep;
+      keep = 0;
+    }
+
+    str = OG_STRING_PTR(buffer);
+    length = RSTRING_LEN(buffer);
+
+    if (eof) {
+      limit = length;
+    } else {
+      limit = length - args->max_match;
+      if (limit < resume)
+        continue;
+      limit = og_oniguruma_stream_char_head(encoding, str, limit);
+    }
+
+    option = ONIG_OPTION_NONE;
+    if (offset > 0) option |= ONIG_OPTION_NOTBOL;
+    if (!eof)       option |= ONIG_OPTION_NOTEOL;
+
+    while (resume <= limit) {
+      result = og_oniguruma_search_string(oregexp->program, buffer, resume, limit,
+        args->region, option, &args->limits);
+
+      if (result == ONIG_MISMATCH) {
+        resume = limit;
+        break;
+      }
+      if (result < 0)
+        og_oniguruma_search_error(result);
+
+      end = args->region->end[0];
+      og_oniguruma_stream_yield(oregexp, args->region, buffer, offset);
+      count++;
+
+      if (end == result) {
+        if (end >= length)
+          break;
+        end += enc_len(encoding, str + end);
+      }
+      resume = end;
+    }
+
+    keep = resume > args->max_match ? resume - args->max_match : 0;
+    keep = og_oniguruma_stream_char_head(encoding, str, keep);
+  }
+
+  return LONG2NUM(count);
+}
+
+static VALUE
+og_oniguruma_stream_cleanup(og_StreamArgs *args)
+{
+  onig_region_free(args->region, 1);
+  return Qnil;
+}
+
+/*
+ * Document-method: scan_io
+ *
+ * call-seq:
+ *    rxp.scan_io(io, options_hash=nil) {|omatch, offset| ... }   => int
+ *
+ * Scans everything read from <i>io</i>, which only needs a
+ * <code>read(length, buffer)</code> method, in constant memory. For every
+ * match an <code>Oniguruma::OMatch</code> over a copy of the matched text
+ * is yielded together with the byte offset of the match in the stream.
+ * Returns the number of matches.
+ *
+ * <code>:chunk</code>::      bytes read at a time, 1M by default.
+ * <code>:max_match</code>::  the longest a match may be, look-around
+ *                            included, 64K by default. Matches which are
+ *                            longer may be missed or cut short.
+ *
+ * <code>:match_limit</code> and <code>:timeout</code> apply to each chunk.
+ *
+ *    File.open('app.log') do |log|
+ *      ORegexp.new('ERROR \[(\w+)\]').scan_io(log, :max_match => 256) do |m, offset|
+ *        puts "#{offset}: #{m[1]}"
+ *      end
+ *    end
+ */
+static VALUE
+og_oniguruma_stream_scan_io(int argc, VALUE *argv, VALUE self)
+{
+  og_ORegexp *oregexp;
+  og_StreamArgs args;
+  VALUE io, options;
+
+  rb_scan_args(argc, argv, "11", &io, &options);
+#ifdef RETURN_ENUMERATOR
+  RETURN_ENUMERATOR(self, argc, argv);
+#else
+  rb_need_block();
+#endif
+
+  if (!NIL_P(options))
+    Check_Type(options, T_HASH);
+
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+
+  args.self = self;
+  args.io = io;
+  args.chunk = og_oniguruma_stream_size(options, "chunk", OG_STREAM_CHUNK_DEFAULT);
+  args.max_match = og_oniguruma_stream_size(options, "max_match", OG_STREAM_MAX_MATCH_DEFAULT);
+  args.limits = oregexp->limits;
+  if (!NIL_P(options))
+    og_oniguruma_search_limits_parse(&args.limits, options);
+  args.region = onig_region_new();
+
+  return rb_ensure(og_oniguruma_stream_do_scan, (VALUE)&args,
+    og_oniguruma_stream_cleanup, (VALUE)&args);
+}
+
+/*
+ * Greps the lines of the length bytes at str, which start at byte offset
+ * in the input; the last line may lack its newline.
+ */
+static void
+og_oniguruma_stream_grep_lines(og_GrepArgs *args, const UChar *str, long length, long offset)
+{
+  int result, selected;
+  long start = 0, end, candidate = -1;
+  const UChar *newline, *found;
+  og_Program *program = args->program;
+
+  while (start < length) {
+    newline = memchr(str + start, '\n', length - start);
+    end = newline == NULL ? length : newline - str;
+
+    /* The literal must lie within the line for the line to match */
+    if (program->literal != NULL && candidate < start) {
+      found = og_oniguruma_search_literal(str + start, length - start, program->literal, program->literal_length);
+      candidate = found == NULL ? length : found - str;
+    }
+
+    if (program->literal != NULL && candidate + program->literal_length > end) {
+      result = ONIG_MISMATCH;
+    } else {
+      result = og_oniguruma_search_bytes(program, str + start, end - start, 0, end - start,
+        NULL, ONIG_OPTION_NONE, &args->limits);
+      if (result < 0 && result != ONIG_MISMATCH)
+        og_oniguruma_search_error(result);
+    }
+
+    selected = (result >= 0) != args->invert;
+
+    if (selected) {
+      args->count++;
+
+      if (!args->count_only) {
+        if (NIL_P(args->results))
+          rb_yield_values(3, LONG2NUM(args->line), LONG2NUM(offset + start), LONG2NUM(offset + end));
+        else
+          rb_ary_push(args->results, rb_ary_new3(3,
+            LONG2NUM(args->line), LONG2NUM(offset + start), LONG2NUM(offset + end)));
+      }
+    }
+
+    args->line++;
+    start = end + 1;
+  }
+}
+
+static VALUE
+og_oniguruma_stream_do_grep(og_GrepArgs *args)
+{
+  long offset = 0, length, complete, earliest;
+  volatile VALUE buffer, data, chunk;
+
+  if (TYPE(args->input) == T_STRING) {
+    /* Searches may release the interpreter lock; keep the bytes in place */
+    buffer = rb_str_new4(args->input);
+    og_oniguruma_stream_grep_lines(args, OG_STRING_PTR(buffer), RSTRING_LEN(buffer), 0);
+  } else {
+    buffer = rb_str_new(0, 0);
+    chunk = rb_str_new(0, 0);
+
+    while (!NIL_P(data = rb_funcall(args->input, og_id_read, 2, LONG2NUM(args->chunk), chunk))) {
+      rb_str_buf_append(buffer, chunk);
+
+      /* Only complete lines are grepped; the rest waits for more input */
+      length = RSTRING_LEN(buffer);
+      earliest = length - RSTRING_LEN(chunk);
+      for (complete = length; complete > earliest && RSTRING_PTR(buffer)[complete - 1] != '\n'; complete--)
+        ;
+      if (complete == earliest)
+        continue;
+
+      og_oniguruma_stream_grep_lines(args, OG_STRING_PTR(buffer), complete, offset);
+
+      offset += complete;
+      buffer = rb_str_new(RSTRING_PTR(buffer) + complete, length - complete);
+    }
+
+    og_oniguruma_stream_grep_lines(args, OG_STRING_PTR(buffer), RSTRING_LEN(buffer), offset);
+  }
+
+  if (args->count_only || NIL_P(args->results))
+    return LONG2NUM(args->count);
+  return args->results;
+}
+
+/*
+ * Document-method: grep_lines
+ *
+ * call-seq:
+ *    rxp.grep_lines(str_or_io, options_hash=nil)                         => [[lineno, begin, end], ...]
+ *    rxp.grep_lines(str_or_io, options_hash=nil) {|lineno, begin, end| }  => int
+ *
+ * Returns the lines of <i>str_or_io</i> which match, as their line number,
+ * counting from 1, and the byte range of the line without its newline. With
+ * a block they are yielded instead, and the number of lines is returned.
+ * Every line is searched on its own, so <code>^</code>, <code>$</code>,
+ * <code>\A</code> and <code>\z</code> apply to the line. An IO is read in
+ * chunks, never holding more than one chunk plus one line.
+ *
+ * <code>:invert</code>::      select the lines which do not match.
+ * <code>:count_only</code>::  only return the number of selected lines.
+ * <code>:chunk</code>::       bytes read from an IO at a time, 1M by default.
+ *
+ * <code>:match_limit</code> and <code>:timeout</code> apply to each line.
+ *
+ *    ORegexp.new('^ERROR').grep_lines("ok\nERROR a\nok\n")   #=> [[2, 3, 10]]
+ */
+static VALUE
+og_oniguruma_stream_grep(int argc, VALUE *argv, VALUE self)
+{
+  og_ORegexp *oregexp;
+  og_GrepArgs args;
+  VALUE input, options;
+
+  rb_scan_args(argc, argv, "11", &input, &options);
+  if (!NIL_P(options))
+    Check_Type(options, T_HASH);
+
+  og_oniguruma_oregexp_reg(self);
+  Data_Get_Struct(self, og_ORegexp, oregexp);
+
+  args.input = TYPE(input) == T_STRING ? input : rb_check_string_type(input);
+  if (NIL_P(args.input))
+    args.input = input;
+  args.chunk = og_oniguruma_stream_size(options, "chunk", OG_STREAM_CHUNK_DEFAULT);
+  args.program = oregexp->program;
+  args.limits = oregexp->limits;
+  args.invert = 0;
+  args.count_only = 0;
+  args.line = 1;
+  args.count = 0;
+
+  if (!NIL_P(options)) {
+    og_oniguruma_search_limits_parse(&args.limits, options);
+    args.invert = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("invert"))));
+    args.count_only = RTEST(rb_hash_aref(options, ID2SYM(rb_intern("count_only"))));
+  }
+
+  args.results = (args.count_only || rb_block_given_p()) ? Qnil : rb_ary_new();
+
+  return og_oniguruma_stream_do_grep(&args);
+}
+
+void
+og_oniguruma_stream(VALUE klass)
+{
+  og_id_read = rb_intern("read");
+
+  rb_define_method(klass, "scan_io",     og_oniguruma_stream_scan_io,  -1);
+  rb_define_method(klass, "grep_lines",  og_oniguruma_stream_grep,     -1);
+}
@@ -3,6 +3,7 @@
 
 #include <ruby.h>       /* for VALUE type */
 #include <oniguruma.h>  /* for OnigRegion */
+#include "rb_oniguruma.h"  /* for og_SearchLimits */
 
 typedef struct og_substitution_args {
   VALUE	self;
@@ -11,14 +12,34 @@ typedef struct og_substitution_args {
   int	global;
   int update_self;
   OnigRegion *region;  
+  og_SearchLimits limits;
 } og_SubstitutionArgs;
 
 typedef struct og_scan_args {
   VALUE self;
   VALUE str;
   OnigRegion * region;
+  og_SearchLimits limits;
+  long limit;               /* stop after this many matches, 0 for all */
 } og_ScanArgs;
 
+typedef struct og_match_many_args {
+  VALUE self;
+  VALUE subjects;
+  int mode;                 /* OG_MATCH_MANY_XXX */
+  OnigRegion *region;
+  og_SearchLimits limits;
+} og_MatchManyArgs;
+
+typedef struct og_offsets_args {
+  VALUE self;
+  VALUE str;
+  int *groups;              /* groups to report, or NULL to only count */
+  int group_count;
+  OnigRegion *region;
+  og_SearchLimits limits;
+} og_OffsetsArgs;
+
 #define og_SubstitutionArgs_set(args_, a, b, c, d, e, f) do { \
   og_SubstitutionArgs *sap = (args_);                         \
   (sap)->self         = (a);                                  \
@@ -34,6 +55,7 @@ typedef struct og_scan_args {
   (sap)->self      = (a);                     \
   (sap)->str       = (b);                     \
   (sap)->region    = (c);                     \
+  (sap)->limit     = 0;                       \
 } while(0)
 
 
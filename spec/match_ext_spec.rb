@@ -45,3 +45,24 @@ describe MatchData, ".offset (with look-behind)" do
     @oregexp.match(@string[4..-1]).should be_nil
   end
 end
+
+describe MatchData, ".to_index" do
+  before(:each) do
+    @oregexp = Oniguruma::ORegexp.new('(?<begin>^.*?)(?<middle>\d)(?<end>.*)')
+  end
+  
+  it "should find named groups" do
+    @oregexp.match("THX1138").to_index(:middle).should eql(2)
+  end
+  
+  it "should share one frozen table between matches" do
+    first  = @oregexp.match("THX1138").instance_variable_get(:@named_captures)
+    second = @oregexp.match("R2D2").instance_variable_get(:@named_captures)
+    first.should equal(second)
+    first.should be_frozen
+  end
+  
+  it "should be nil without named groups" do
+    Oniguruma::ORegexp.new('(\d)').match("THX1138").to_index(:middle).should be_nil
+  end
+end
@@ -182,6 +182,15 @@ describe Oniguruma::ORegexp, ".match" do
   it "should not match '12145614'" do
     @oregexp.match("12145614").should be_nil
   end
+  
+  it "should keep earlier matches intact when matching again" do
+    first  = @oregexp.match("12345634")
+    second = @oregexp.match("xx3a--3b")
+    @oregexp.match("12145614")
+    first.offset(1).should eql([2,4])
+    second.offset(1).should eql([2,4])
+    second[3].should eql("3b")
+  end
 end
 
 describe Oniguruma::ORegexp, ".match (back references)" do
@@ -279,6 +288,10 @@ describe Oniguruma::ORegexp, "==" do
     @oregexp.should_not eql(Oniguruma::ORegexp.new('expression', 
                               :encoding => Oniguruma::ENCODING_UTF8))
   end
+  
+  it "should not be equal to a non ORegexp" do
+    (@oregexp == 'expression').should be_false
+  end
 end
 
 describe Oniguruma::ORegexp, "===" do
@@ -419,9 +432,35 @@ describe Oniguruma::ORegexp, ".scan" do
   
   it "should scan and yield matches to block" do
     result = ''
-    @oregexp.scan(@string) { |m| result << "<<#{m}>>" }
+    @oregexp.scan(@string) { |m| result << "<<#{m}>>" }.should equal(@string)
     result.should eql("<<cruel>><<world>>")
   end
+  
+  it "should stop after a limit" do
+    @oregexp.scan(@string, :limit => 1).collect { |m| m.to_s }.should == ['cruel']
+    @oregexp.scan(@string, :limit => 5).size.should eql(2)
+    lambda { @oregexp.scan(@string, :limit => 0) }.should raise_error(ArgumentError)
+  end
+end
+
+describe Oniguruma::ORegexp, ".each_match" do
+  before(:each) do
+    @oregexp = Oniguruma::ORegexp.new('\w+')
+    @string  = 'cruel world'
+  end
+  
+  it "should yield matches" do
+    result = []
+    @oregexp.each_match(@string) { |m| result << m.to_s }.should equal(@string)
+    result.should == ['cruel', 'world']
+  end
+  
+  it "should search only as far as it is consumed" do
+    matches = Oniguruma::ORegexp.new('x').each_match('x' * 1000000).first(10)
+    matches.size.should eql(10)
+    matches.last.begin(0).should eql(9)
+    @oregexp.each_match(@string, :limit => 1).to_a.size.should eql(1)
+  end
 end
 
 describe Oniguruma::ORegexp, ".casefold?" do
@@ -484,6 +523,18 @@ describe Oniguruma::ORegexp, ".source" do
   it "should return '[a-z][a-z0-9_]+'" do
     @oregexp.source.should eql('[a-z][a-z0-9_]+')
   end
+  
+  it "should be frozen" do
+    @oregexp.source.should be_frozen
+  end
+  
+  it "should not freeze or track the original pattern" do
+    pattern = '[a-z]+'
+    oregexp = Oniguruma::ORegexp.new(pattern)
+    pattern.should_not be_frozen
+    pattern << '[0-9]'
+    oregexp.source.should eql('[a-z]+')
+  end
 end
 
 describe Oniguruma::ORegexp, ".to_s" do
@@ -510,4 +561,903 @@ describe Oniguruma::ORegexp, ".inspect" do
       :options => Oniguruma::OPTION_IGNORECASE)
     o.inspect.should eql("/[a-z][a-z0-9_]+/i")
   end
-end
\ No newline at end of file
+end
+describe Oniguruma::ORegexp, ".cache_stats" do
+  before(:each) do
+    Oniguruma::ORegexp.clear_cache
+  end
+  
+  it "should count a miss then a hit for the same pattern" do
+    Oniguruma::ORegexp.new('cache(d)?')
+    Oniguruma::ORegexp.new('cache(d)?')
+    stats = Oniguruma::ORegexp.cache_stats
+    stats[:misses].should eql(1)
+    stats[:hits].should eql(1)
+  end
+  
+  it "should not share programs between different options" do
+    Oniguruma::ORegexp.new('cache(d)?')
+    Oniguruma::ORegexp.new('cache(d)?', :options => Oniguruma::OPTION_IGNORECASE)
+    Oniguruma::ORegexp.cache_stats[:misses].should eql(2)
+  end
+  
+  it "should evict least recently used patterns" do
+    size = Oniguruma::ORegexp.cache_size
+    begin
+      Oniguruma::ORegexp.cache_size = 2
+      %w(a b c).each { |p| Oniguruma::ORegexp.new(p) }
+      Oniguruma::ORegexp.cache_stats[:evictions].should eql(1)
+      Oniguruma::ORegexp.cache_stats[:size].should eql(2)
+    ensure
+      Oniguruma::ORegexp.cache_size = size
+    end
+  end
+  
+  it "should keep evicted programs usable" do
+    size = Oniguruma::ORegexp.cache_size
+    begin
+      Oniguruma::ORegexp.cache_size = 1
+      r = Oniguruma::ORegexp.new('a+')
+      Oniguruma::ORegexp.new('b+')
+      r.match('caaat')[0].should eql('aaa')
+    ensure
+      Oniguruma::ORegexp.cache_size = size
+    end
+  end
+end
+
+describe Oniguruma::ORegexp, ".hash" do
+  it "should be equal for eql? regexps" do
+    Oniguruma::ORegexp.new('expression').hash.should eql(Oniguruma::ORegexp.new('expression').hash)
+  end
+  
+  it "should work as a Hash key" do
+    h = { Oniguruma::ORegexp.new('expression') => :found }
+    h[Oniguruma::ORegexp.new('expression')].should eql(:found)
+    h[Oniguruma::ORegexp.new('expression', :syntax => Oniguruma::SYNTAX_JAVA)].should be_nil
+  end
+end
+
+describe Oniguruma::ORegexp, ".new(pattern, :lazy => true)" do
+  it "should not compile until first use" do
+    oregexp = Oniguruma::ORegexp.new('l(a)zy', :lazy => true)
+    oregexp.should_not be_compiled
+    oregexp.match('lazy')[1].should eql('a')
+    oregexp.should be_compiled
+  end
+  
+  it "should not raise on a bad expression until first use" do
+    oregexp = nil
+    lambda {
+      oregexp = Oniguruma::ORegexp.new("(3.)(.*)(3.))", :lazy => true)
+    }.should_not raise_error
+    lambda { oregexp.match('333') }.should raise_error(ArgumentError)
+    lambda { oregexp.scan('333') }.should raise_error(ArgumentError)
+  end
+end
+
+describe Oniguruma::ORegexp, ".warm" do
+  it "should compile every lazy regexp" do
+    list = %w(a b c).map { |p| Oniguruma::ORegexp.new(p, :lazy => true) }
+    Oniguruma::ORegexp.warm(list).should equal(list)
+    list.each { |r| r.should be_compiled }
+  end
+  
+  it "should raise ArgumentError on a bad expression" do
+    list = [Oniguruma::ORegexp.new("(3.))", :lazy => true)]
+    lambda { Oniguruma::ORegexp.warm(list) }.should raise_error(ArgumentError)
+  end
+end
+
+describe Oniguruma::ORegexp, ".compile_all" do
+  it "should return regexps in input order" do
+    list = Oniguruma::ORegexp.compile_all(['\d+', ['cat', 'i'], ['dog', { :syntax => Oniguruma::SYNTAX_JAVA }]])
+    list.map { |r| r.source }.should eql(['\d+', 'cat', 'dog'])
+    list.each { |r| r.should be_compiled }
+    list[1].should be_casefold
+  end
+  
+  it "should compile on several threads" do
+    patterns = (1..200).map { |i| "(?<n#{i}>a{#{i}})b" }
+    list = Oniguruma::ORegexp.compile_all(patterns, 4)
+    list[199].match('a' * 200 + 'b').should_not be_nil
+  end
+  
+  it "should compile case-insensitive UTF-8 patterns on several threads from a cold start" do
+    # A fresh interpreter, so the case fold and property tables are not built yet
+    script = Tempfile.new('compile_all')
+    script.write(<<-'SCRIPT')
+      require 'oniguruma'
+      options = { :options => Oniguruma::OPTION_IGNORECASE, :encoding => Oniguruma::ENCODING_UTF8 }
+      patterns = (1..400).map { |i| ["caf\303\251 #{i}\\p{Alpha}", options] }
+      list = Oniguruma::ORegexp.compile_all(patterns, 8)
+      print((0...list.size).select { |i| list[i].match?("CAF\303\211 #{i + 1}x") }.size)
+    SCRIPT
+    script.close
+    config = defined?(RbConfig) ? RbConfig::CONFIG : Config::CONFIG
+    ruby = File.join(config['bindir'], config['ruby_install_name'])
+    IO.popen("#{ruby} -I #{File.dirname(__FILE__) + '/../ext'} #{script.path}") { |io| io.read }.should == '400'
+  end
+  
+  it "should raise ArgumentError naming every failed pattern" do
+    lambda {
+      Oniguruma::ORegexp.compile_all(['ok', '(bad', 'fine', 'bad)'])
+    }.should raise_error(ArgumentError, /1: .*3: /)
+  end
+  
+  it "should yield failed patterns to the block" do
+    failed = []
+    list = Oniguruma::ORegexp.compile_all(['ok', '(bad']) { |i, message| failed << i }
+    failed.should eql([1])
+    list[0].should_not be_nil
+    list[1].should be_nil
+  end
+end
+
+describe Oniguruma::ORegexp, ".analysis" do
+  before(:each) do
+    # Only Oniguruma 5 and earlier let the optimizer results be read
+    @internals = !Oniguruma::ORegexp.new('a').analysis[:optimization].nil?
+  end
+  
+  it "should report the required literal and where it starts" do
+    analysis = Oniguruma::ORegexp.new('ab?ERROR (\d+)').analysis
+    analysis[:captures].should eql(1)
+    if @internals
+      analysis[:literal].should == 'ERROR '
+      analysis[:literal_offset].should == [1, 2]
+    else
+      analysis[:literal].should be_nil
+      analysis[:literal_offset].should be_nil
+    end
+  end
+  
+  it "should report an unbounded literal offset as nil" do
+    analysis = Oniguruma::ORegexp.new('x*timeout').analysis
+    if @internals
+      analysis[:literal].should == 'timeout'
+      analysis[:literal_offset].should == [0, nil]
+    else
+      analysis[:literal].should be_nil
+    end
+  end
+  
+  it "should report anchors" do
+    anchor = Oniguruma::ORegexp.new('\Aabc').analysis[:anchor]
+    @internals ? anchor.should(include(:begin_buf)) : anchor.should(be_nil)
+  end
+  
+  it "should report match lengths for end anchored patterns only" do
+    Oniguruma::ORegexp.new('ab{2,3}\z').analysis[:end_anchor_length].should == (@internals ? [3, 4] : nil)
+    Oniguruma::ORegexp.new('ab{2,3}').analysis[:end_anchor_length].should be_nil
+  end
+end
+
+describe Oniguruma::ORegexp, ".bytecode" do
+  it "should dump the bytecode" do
+    if Oniguruma::ORegexp.new('a').analysis[:optimization]
+      Oniguruma::ORegexp.new('ab+').bytecode.should match(/\A0000:( [0-9a-f]{2})+\n/)
+    else
+      lambda { Oniguruma::ORegexp.new('ab+').bytecode }.should raise_error(NotImplementedError)
+    end
+  end
+end
+
+describe Oniguruma::ORegexp, ".omatch" do
+  before(:each) do
+    @reg = Oniguruma::ORegexp.new('(?<area>\d+)-(?<number>\d+)(x)?')
+  end
+  
+  it "should return nil for no match" do
+    @reg.omatch('no digits').should be_nil
+  end
+  
+  it "should report offsets and captures" do
+    m = @reg.omatch('call 555-1234 now')
+    m.should be_an_instance_of(Oniguruma::OMatch)
+    m.to_s.should == '555-1234'
+    m.offset.should == [5, 13]
+    m.begin(2).should eql(9)
+    m[1].should == '555'
+    m[:number].should == '1234'
+    m['area'].should == '555'
+    m[3].should be_nil
+    m.begin(3).should be_nil
+    m.size.should eql(4)
+    m.captures.should == ['555', '1234', nil]
+    m.pre_match.should == 'call '
+    m.post_match.should == ' now'
+  end
+  
+  it "should not track the subject after the match" do
+    string = 'call 555-1234'
+    m = @reg.omatch(string)
+    string.replace('changed')
+    m[0].should == '555-1234'
+    m.string.should be_frozen
+  end
+  
+  it "should not set last match" do
+    Oniguruma::ORegexp.new('none').match('none')
+    @reg.omatch('555-1234')
+    $~[0].should == 'none'
+  end
+  
+  it "should convert to MatchData" do
+    m = @reg.omatch('call 555-1234').to_match_data
+    m.should be_kind_of(MatchData)
+    m[:number].should == '1234'
+    m.offset(1).should == [5, 8]
+  end
+end
+
+describe Oniguruma::ORegexp, ".match?, .index and .start_with?" do
+  before(:each) do
+    @reg = Oniguruma::ORegexp.new('(b)(?:a|b)')
+  end
+  
+  it "should answer without setting last match" do
+    Oniguruma::ORegexp.new('none').match('none')
+    @reg.match?('abba').should be_true
+    @reg.match?('aaaa').should be_false
+    $~[0].should == 'none'
+  end
+  
+  it "should honour the start position" do
+    @reg.match?('abba', 3).should be_false
+    @reg.index('abbab').should eql(1)
+    @reg.index('abbab', 2).should eql(2)
+    @reg.index('abbab', -2).should be_nil
+    @reg.index('ab', 5).should be_nil
+  end
+  
+  it "should only match at the given position for start_with?" do
+    @reg.start_with?('abba').should be_false
+    @reg.start_with?('abba', 1).should be_true
+  end
+  
+  it "should work with back references" do
+    reg = Oniguruma::ORegexp.new('(a)\1')
+    reg.match?('xaa').should be_true
+    reg.index('xaa').should eql(1)
+  end
+end
+
+describe Oniguruma::ORegexp, ".last_match in threads" do
+  it "should keep the last match per thread" do
+    Oniguruma::ORegexp.new('main').match('main')
+    Thread.new { Oniguruma::ORegexp.new('other').match('other') }.join
+    Oniguruma::ORegexp.last_match(0).should eql('main')
+  end
+  
+  it "should start out empty in a new thread" do
+    Oniguruma::ORegexp.new('main').match('main')
+    Thread.new { Oniguruma::ORegexp.last_match }.value.should be_nil
+  end
+end
+
+describe Oniguruma::ORegexp, ".new(pattern, :last_match => false)" do
+  it "should not update last match" do
+    Oniguruma::ORegexp.new('before').match('before')
+    reg = Oniguruma::ORegexp.new('after', :last_match => false)
+    reg.match('after')[0].should == 'after'
+    Oniguruma::ORegexp.last_match(0).should eql('before')
+    $~[0].should == 'before'
+  end
+end
+
+describe Oniguruma::ORegexp, ".track_last_match=" do
+  after(:each) do
+    Oniguruma::ORegexp.track_last_match = true
+  end
+  
+  it "should turn last match tracking off" do
+    Oniguruma::ORegexp.track_last_match = false
+    Oniguruma::ORegexp.track_last_match?.should be_false
+    Oniguruma::ORegexp.new('cat').match('cat')
+    Oniguruma::ORegexp.last_match.should be_nil
+  end
+  
+  it "should be overridden by :last_match => true" do
+    Oniguruma::ORegexp.track_last_match = false
+    Oniguruma::ORegexp.new('cat', :last_match => true).match('cat')
+    Oniguruma::ORegexp.last_match(0).should eql('cat')
+  end
+end
+
+describe Oniguruma::ORegexp, " searching large subjects" do
+  before(:each) do
+    @threshold = Oniguruma::ORegexp.nogvl_threshold
+    Oniguruma::ORegexp.nogvl_threshold = 1024
+  end
+  
+  after(:each) do
+    Oniguruma::ORegexp.nogvl_threshold = @threshold
+  end
+  
+  it "should find the same matches as small ones" do
+    subject = ('x' * 600_000) + 'needle 42' + ('y' * 600_000) + 'needle 7'
+    reg = Oniguruma::ORegexp.new('needle (\d+)')
+    reg.match(subject).offset(1).should == [600_007, 600_009]
+    reg.scan(subject).map { |m| m[1] }.should == ['42', '7']
+    reg.gsub(subject, 'N').length.should eql(1_200_002)
+    reg.index(subject, 600_001).should eql(1_200_009)
+  end
+  
+  it "should not split multibyte characters between windows" do
+    subject = 'x' + "\xc3\xa9" * 400_000 + 'end'
+    reg = Oniguruma::ORegexp.new('.end', :encoding => Oniguruma::ENCODING_UTF8)
+    reg.match(subject).begin(0).should eql(799_999)
+  end
+  
+  if RUBY_VERSION >= '1.9'
+    it "should let other threads interrupt the search" do
+      reg = Oniguruma::ORegexp.new('a{1,100}\d')
+      subject = 'a' * 20_000_000
+      started = Time.now
+      lambda {
+        Timeout.timeout(0.2) { reg.match(subject) }
+      }.should raise_error(Timeout::Error)
+      (Time.now - started).should < 2
+    end
+    
+    it "should let other threads interrupt a single slow attempt in one window" do
+      begin
+        Oniguruma::ORegexp.new('a', :match_limit => 1)
+      rescue NotImplementedError
+        pending('the linked Oniguruma has no retry limit')
+      end
+      # \G keeps the search in one window, and the attempt at 0 never ends
+      reg = Oniguruma::ORegexp.new('\\G(a|aa)+$')
+      started = Time.now
+      lambda {
+        Timeout.timeout(0.2) { reg.match('a' * 2000 + 'b') }
+      }.should raise_error(Timeout::Error)
+      (Time.now - started).should < 2
+    end
+    
+    it "should let other threads run during the search" do
+      # Holding the lock, one long C call would keep the counter still
+      counter = 0
+      counting = Thread.new { loop { counter += 1 } }
+      Thread.pass while counter == 0
+      
+      before = counter
+      Oniguruma::ORegexp.new('a{1,20}\d').match('a' * 5_000_000).should be_nil
+      progress = counter - before
+      counting.kill
+      
+      progress.should > 0
+    end
+  end
+end
+
+describe Oniguruma::ORegexp, " with a timeout" do
+  before(:each) do
+    @reg = Oniguruma::ORegexp.new('a{1,100}\d', :timeout => 0.05)
+    @subject = 'a' * 5_000_000
+  end
+  
+  it "should raise MatchTimeout instead of running on" do
+    lambda { @reg.match(@subject) }.should raise_error(Oniguruma::MatchTimeout)
+    lambda { @reg.scan(@subject) }.should raise_error(Oniguruma::MatchTimeout)
+    lambda { @reg.gsub(@subject, '') }.should raise_error(Oniguruma::MatchTimeout)
+    lambda { @subject.ogsub(@reg, '') }.should raise_error(Oniguruma::MatchTimeout)
+  end
+  
+  it "should be overridden per call" do
+    @reg.match('aaa1', :timeout => 0).should_not be_nil
+    lambda {
+      Oniguruma::ORegexp.new('a{1,100}\d').match(@subject, :timeout => 0.05)
+    }.should raise_error(Oniguruma::MatchTimeout)
+  end
+  
+  it "should use the default timeout" do
+    begin
+      Oniguruma::ORegexp.default_timeout = 0.05
+      lambda {
+        Oniguruma::ORegexp.new('a{1,100}\d').match?(@subject)
+      }.should raise_error(Oniguruma::MatchTimeout)
+    ensure
+      Oniguruma::ORegexp.default_timeout = 0
+    end
+  end
+  
+  it "should reject negative limits" do
+    lambda { Oniguruma::ORegexp.new('a', :timeout => -1) }.should raise_error(ArgumentError)
+  end
+end
+
+describe Oniguruma::ORegexp, " with a match limit" do
+  before(:each) do
+    # One match attempt at the first position, billions of retries
+    @subject = 'a' * 40 + 'b'
+    begin
+      Oniguruma::ORegexp.new('a', :match_limit => 1)
+      @retry_limit = true
+    rescue NotImplementedError
+      @retry_limit = false
+    end
+  end
+  
+  it "should stop catastrophic backtracking" do
+    pending('the linked Oniguruma has no retry limit') unless @retry_limit
+    reg = Oniguruma::ORegexp.new('(a|aa)+$', :match_limit => 10_000)
+    lambda { reg.match(@subject) }.should raise_error(Oniguruma::MatchTimeout)
+  end
+  
+  it "should time out within a single match attempt on a short subject" do
+    pending('the linked Oniguruma has no retry limit') unless @retry_limit
+    reg = Oniguruma::ORegexp.new('(a|aa)+$', :timeout => 0.05)
+    lambda {
+      Timeout.timeout(5) { reg.match(@subject) }
+    }.should raise_error(Oniguruma::MatchTimeout)
+  end
+  
+  it "should apply limits to start_with?" do
+    pending('the linked Oniguruma has no retry limit') unless @retry_limit
+    lambda {
+      Oniguruma::ORegexp.new('(a|aa)+$', :match_limit => 10_000).start_with?(@subject)
+    }.should raise_error(Oniguruma::MatchTimeout)
+    lambda {
+      Oniguruma::ORegexp.new('(a|aa)+$').start_with?(@subject, 0, :match_limit => 10_000)
+    }.should raise_error(Oniguruma::MatchTimeout)
+    Oniguruma::ORegexp.new('a+b', :match_limit => 10_000).start_with?(@subject).should be_true
+  end
+  
+  it "should apply limits to the anchored scanner methods" do
+    pending('the linked Oniguruma has no retry limit') unless @retry_limit
+    reg = Oniguruma::ORegexp.new('(a|aa)+$', :match_limit => 10_000)
+    scanner = Oniguruma::OScanner.new(@subject)
+    lambda { scanner.scan(reg) }.should raise_error(Oniguruma::MatchTimeout)
+    lambda { scanner.check(reg) }.should raise_error(Oniguruma::MatchTimeout)
+    scanner.pos.should eql(0)
+  end
+  
+  it "should leave a Hash replacement to sub and gsub" do
+    reg = Oniguruma::ORegexp.new('a')
+    lambda { reg.gsub('abc', { :timeout => 1 }) }.should raise_error(TypeError)
+    reg.gsub('abc', { :timeout => 1 }) { 'x' }.should == 'xbc'
+    reg.sub('abc', 'x', :timeout => 1).should == 'xbc'
+  end
+end
+
+describe Oniguruma::ORegexp::Set do
+  before(:each) do
+    @patterns = ['union\s+select', '<script', 'etc/(passwd|shadow)', '\d{4,}', 'x', 'e.c/']
+    @set = Oniguruma::ORegexp::Set.new(@patterns)
+  end
+  
+  it "should return the indices of every matching pattern" do
+    @set.matches('GET /etc/passwd?id=12345').should == [2, 3, 5]
+    @set.matches('nothing to see').should == []
+    @set.matches('union   select x').should == [0, 4]
+  end
+  
+  it "should agree with running the patterns one by one" do
+    regexps = @patterns.map { |p| Oniguruma::ORegexp.new(p) }
+    ['<script>alert(1)</script>', 'etc/shadow', 'ebc/', '', 'x1999', 'union select'].each do |subject|
+      expected = (0...regexps.size).select { |i| regexps[i].match?(subject) }
+      @set.matches(subject).should == expected
+    end
+  end
+  
+  it "should agree with the patterns one by one for large sets and long subjects" do
+    words = (1..40).map { |i| "word#{i}x" } + ['a\d+z', 'q']
+    set = Oniguruma::ORegexp::Set.new(words)
+    regexps = words.map { |p| Oniguruma::ORegexp.new(p) }
+    ['word7x', 'a12z q', ('.' * 5000) + 'word33x' + ('-' * 5000) + 'word3x a1z'].each do |subject|
+      expected = (0...regexps.size).select { |i| regexps[i].match?(subject) }
+      set.matches(subject).should == expected
+    end
+  end
+  
+  it "should search from the atom without missing earlier match starts" do
+    patterns = ['\d+ERROR', 'a.{0,3}ERROR', '(?<=x)ERROR', 'ERROR$']
+    set = Oniguruma::ORegexp::Set.new(patterns)
+    regexps = patterns.map { |p| Oniguruma::ORegexp.new(p) }
+    ['12345ERROR', 'aERROR ERROR', 'ab ERROR xERROR', 'ERROR ERROR', 'no error'].each do |subject|
+      expected = (0...regexps.size).select { |i| regexps[i].match?(subject) }
+      set.matches(subject).should == expected
+    end
+  end
+  
+  it "should answer match? and index" do
+    @set.match?('<script').should be_true
+    @set.match?('harmless').should be_false
+    @set.index('1234 x').should eql(3)
+    @set.index('harmless').should be_nil
+  end
+  
+  it "should report the atoms of the patterns" do
+    # Oniguruma 6 and later do not expose them, and every pattern is run
+    if Oniguruma::ORegexp.new('a').analysis[:optimization]
+      @set.atoms[1].should == '<script'
+    else
+      @set.atoms[1].should be_nil
+    end
+    @set.atoms[3].should be_nil
+  end
+  
+  it "should accept ORegexp objects and options" do
+    set = Oniguruma::ORegexp::Set.new([Oniguruma::ORegexp.new('abc'), 'DEF'],
+      :options => Oniguruma::OPTION_IGNORECASE)
+    set.matches('abc def').should == [0, 1]
+    set.size.should eql(2)
+    set.patterns.should be_frozen
+  end
+  
+  it "should be usable from several threads" do
+    results = (1..4).map { Thread.new { @set.matches('etc/passwd 2024') } }.map { |t| t.value }
+    results.uniq.should == [[2, 3, 5]]
+  end
+end
+
+describe Oniguruma::ORegexp, ".new(pattern, :memo => true)" do
+  before(:each) do
+    @reg = Oniguruma::ORegexp.new('(\w+)\(', :memo => true)
+    @line = 'x = 1 + call(2) + other(3)'
+  end
+  
+  it "should answer repeated searches from increasing starts" do
+    plain = Oniguruma::ORegexp.new('(\w+)\(')
+    [0, 3, 8, 9, 12, 13, 20, 26, 27].each do |start|
+      expected = plain.match(@line, start)
+      found = @reg.match(@line, start)
+      if expected.nil?
+        found.should be_nil
+      else
+        found.offset(1).should == expected.offset(1)
+      end
+    end
+  end
+  
+  it "should notice the subject was modified" do
+    @reg.match(@line, 0).begin(0).should eql(8)
+    @line[8, 4] = 'cell'
+    @reg.match(@line, 2)[1].should == 'cell'
+    @line[8, 4] = 'ca  '
+    @reg.match(@line, 3)[1].should == 'other'
+  end
+  
+  it "should notice modifications of short subjects" do
+    line = 'ab(c'
+    @reg.match(line, 0)[1].should == 'ab'
+    line[0, 4] = 'a b('
+    @reg.match(line, 0)[1].should == 'b'
+  end
+  
+  it "should remember mismatches" do
+    line = 'no calls'
+    @reg.match(line, 0).should be_nil
+    @reg.match(line, 3).should be_nil
+    line << '()'
+    @reg.match(line, 3)[1].should == 'calls'
+  end
+end
+
+describe Oniguruma::ORegexp, "with a required literal" do
+  before(:each) do
+    @reg = Oniguruma::ORegexp.new('ERROR \[(\w+)\].*timeout=(\d+)')
+    @log = ("INFO [db] ok timeout=1\n" * 2000) + "ERROR [net] timeout=30\n" + ("INFO ok\n" * 100)
+  end
+  
+  it "should find matches far into the subject" do
+    match = @reg.match(@log)
+    match.begin(0).should eql(@log.index('ERROR'))
+    match[1].should == 'net'
+    match[2].should == '30'
+  end
+  
+  it "should not match subjects without the literal" do
+    @reg.match(@log.gsub('ERROR', 'WARN')).should be_nil
+    @reg.match(@log, @log.index('ERROR') + 1).should be_nil
+  end
+  
+  it "should agree with Regexp when scanning and substituting" do
+    reg = Oniguruma::ORegexp.new('\d+ms')
+    str = 'took 12ms, 7 items, 300ms; 4ms ' * 50
+    reg.scan(str).map { |m| m[0] }.should == str.scan(/\d+ms/)
+    reg.gsub(str, '<\0>').should == str.gsub(/\d+ms/, '<\0>')
+  end
+  
+  it "should keep lookbehind and anchors working" do
+    Oniguruma::ORegexp.new('(?<=ab)cd').match('xxabcd', 1).begin(0).should eql(4)
+    Oniguruma::ORegexp.new('^key=').match("a\nb\nkey=1").begin(0).should eql(4)
+    Oniguruma::ORegexp.new('\Gab').match('xxab', 0).should be_nil
+  end
+end
+
+describe Oniguruma::ORegexp, "with a plain string pattern" do
+  before(:each) do
+    @text = ('Error: disk FULL; retry. error: Disk full? ' * 40) + 'end'
+  end
+  
+  it "should match like the same pattern run by the engine" do
+    ['disk full', 'Disk full?', 'end', 'missing', 'r'].each do |literal|
+      plain = Oniguruma::ORegexp.new(literal.sub('?', '\?'))
+      engine = Oniguruma::ORegexp.new("(?:#{literal.sub('?', '\?')})")
+      [0, 5, 100, @text.size - 3].each do |start|
+        expected = engine.match(@text, start)
+        found = plain.match(@text, start)
+        (found && found.offset(0)).should == (expected && expected.offset(0))
+      end
+    end
+  end
+  
+  it "should ignore case like the engine" do
+    ['disk full', 'ERROR:', 'retry.'].each do |literal|
+      options = { :options => Oniguruma::OPTION_IGNORECASE }
+      plain = Oniguruma::ORegexp.new(literal.sub('.', '\.'), options)
+      engine = Oniguruma::ORegexp.new("(?:#{literal.sub('.', '\.')})", options)
+      plain.scan(@text).map { |m| m.offset(0) }.should == engine.scan(@text).map { |m| m.offset(0) }
+      plain.gsub(@text, '<\0>').should == engine.gsub(@text, '<\0>')
+    end
+  end
+  
+  it "should give a match without groups" do
+    match = Oniguruma::ORegexp.new('retry').match(@text)
+    match.to_a.should == ['retry']
+    match.pre_match.should == @text[0, match.begin(0)]
+  end
+  
+  it "should still fold non-ASCII equivalents in UTF-8" do
+    options = { :options => Oniguruma::OPTION_IGNORECASE, :encoding => Oniguruma::ENCODING_UTF8 }
+    Oniguruma::ORegexp.new('strasse', options).match("Stra\303\237e").should_not be_nil
+    Oniguruma::ORegexp.new('k', options).match("\342\204\252").should_not be_nil
+  end
+end
+
+describe Oniguruma::ORegexp, ".scan_io" do
+  before(:each) do
+    @log = (1..500).map { |i| "#{i} INFO ok\n#{i} ERROR [disk#{i}] timeout=#{i * 3}\n" }.join
+    @reg = Oniguruma::ORegexp.new('ERROR \[(\w+)\] timeout=(\d+)')
+  end
+  
+  it "should find the matches of scan across chunk edges" do
+    expected = @reg.scan(@log).map { |m| [m.begin(0), m[1], m[2]] }
+    [7, 64, 1000, 1 << 20].each do |chunk|
+      found = []
+      @reg.scan_io(StringIO.new(@log), :chunk => chunk, :max_match => 64) do |m, offset|
+        found << [offset, m[1], m[2]]
+      end
+      found.should == expected
+    end
+  end
+  
+  it "should return the number of matches" do
+    @reg.scan_io(StringIO.new(@log), :chunk => 100, :max_match => 64) { }.should eql(500)
+  end
+  
+  it "should only match line anchors at real line edges" do
+    reg = Oniguruma::ORegexp.new('^\d+ ERROR')
+    offsets = []
+    reg.scan_io(StringIO.new(@log), :chunk => 5, :max_match => 16) { |m, offset| offsets << offset }
+    offsets.should == reg.scan(@log).map { |m| m.begin(0) }
+    
+    ends = []
+    Oniguruma::ORegexp.new('ok$').scan_io(StringIO.new("ok ok\nok"), :chunk => 2, :max_match => 4) { |m, o| ends << o }
+    ends.should == [3, 6]
+  end
+  
+  it "should step over empty matches" do
+    found = []
+    Oniguruma::ORegexp.new('b*').scan_io(StringIO.new('abba'), :chunk => 1, :max_match => 4) { |m, o| found << [o, m[0]] }
+    found.should == [[0, ''], [1, 'bb'], [3, ''], [4, '']]
+  end
+  
+  it "should reject sizes which are not positive" do
+    lambda { @reg.scan_io(StringIO.new(@log), :chunk => 0) { } }.should raise_error(ArgumentError)
+  end
+end
+
+describe Oniguruma::ORegexp, ".scan_file" do
+  before(:each) do
+    @text = (1..300).map { |i| "#{i} ERROR code=#{i % 7}\n" }.join
+    @file = Tempfile.new('oniguruma')
+    @file.write(@text)
+    @file.close
+    @reg = Oniguruma::ORegexp.new('code=[0-3]')
+  end
+  
+  after(:each) do
+    @file.unlink
+  end
+  
+  it "should return the offsets scan finds" do
+    @reg.scan_file(@file.path).should == @reg.scan(@text).map { |m| m.offset(0) }
+  end
+  
+  it "should give substrings on request" do
+    @reg.scan_file(@file.path, :substrings => true).should == @reg.scan(@text).map { |m| m[0] }
+  end
+  
+  it "should yield and count" do
+    pairs = []
+    @reg.scan_file(@file.path) { |pair| pairs << pair }.should eql(pairs.size)
+    @reg.count_file(@file.path).should eql(pairs.size)
+    Oniguruma::ORegexp.new('missing').count_file(@file.path).should eql(0)
+  end
+  
+  it "should handle empty files and empty matches" do
+    empty = Tempfile.new('oniguruma')
+    empty.close
+    Oniguruma::ORegexp.new('x*').scan_file(empty.path).should == [[0, 0]]
+    Oniguruma::ORegexp.new('a').count_file(empty.path).should eql(0)
+    empty.unlink
+  end
+  
+  it "should raise for missing files" do
+    lambda { @reg.count_file('/nonexistent/oniguruma') }.should raise_error(SystemCallError)
+  end
+end
+
+describe Oniguruma::ORegexp, ".grep_lines" do
+  before(:each) do
+    @text = "ok 1\nERROR disk\n\nok 2\nan ERROR\nlast ERROR"
+    @reg = Oniguruma::ORegexp.new('^ERROR')
+  end
+  
+  it "should return line numbers and byte ranges" do
+    @reg.grep_lines(@text).should == [[2, 5, 15]]
+    Oniguruma::ORegexp.new('ERROR').grep_lines(@text).map { |l| l[0] }.should == [2, 5, 6]
+    Oniguruma::ORegexp.new('ERROR').grep_lines(@text).last.should == [6, 31, 41]
+  end
+  
+  it "should apply anchors to each line" do
+    Oniguruma::ORegexp.new('\A\z').grep_lines(@text).should == [[3, 16, 16]]
+    Oniguruma::ORegexp.new('\d\z').grep_lines(@text).map { |l| l[0] }.should == [1, 4]
+  end
+  
+  it "should invert and count" do
+    @reg.grep_lines(@text, :invert => true).map { |l| l[0] }.should == [1, 3, 4, 5, 6]
+    @reg.grep_lines(@text, :count_only => true).should eql(1)
+    Oniguruma::ORegexp.new('ERROR').grep_lines(@text, :count_only => true, :invert => true).should eql(3)
+  end
+  
+  it "should yield lines" do
+    lines = []
+    Oniguruma::ORegexp.new('ok').grep_lines(@text) { |n, b, e| lines << @text[b...e] }.should eql(2)
+    lines.should == ['ok 1', 'ok 2']
+  end
+  
+  it "should read lines from an IO" do
+    text = (1..20000).map { |i| i % 1000 == 0 ? "#{i} ERROR" : "#{i} ok" }.join("\n")
+    reg = Oniguruma::ORegexp.new('ERROR')
+    reg.grep_lines(StringIO.new(text)).should == reg.grep_lines(text)
+    reg.grep_lines(StringIO.new(text)).size.should eql(20)
+  end
+  
+  it "should carry lines across reads" do
+    text = "ok\nERROR a line longer than one read\n\nERROR\nok ERROR\nERROR no newline"
+    reg = Oniguruma::ORegexp.new('^ERROR')
+    [1, 2, 5, 7, 64].each do |chunk|
+      reg.grep_lines(StringIO.new(text), :chunk => chunk).should == reg.grep_lines(text)
+      reg.grep_lines(StringIO.new(text), :chunk => chunk, :invert => true).should == reg.grep_lines(text, :invert => true)
+    end
+    reg.grep_lines(StringIO.new(text), :chunk => 3).should == [[2, 3, 36], [4, 38, 43], [6, 53, 69]]
+    reg.grep_lines(StringIO.new(text), :chunk => 3, :count_only => true).should eql(3)
+  end
+  
+  it "should refuse a chunk which is not positive" do
+    lambda { @reg.grep_lines(StringIO.new(@text), :chunk => 0) }.should raise_error(ArgumentError)
+  end
+end
+
+describe Oniguruma::ORegexp, ".parallel_scan" do
+  before(:each) do
+    @text = (1..50000).map { |i| i % 997 == 0 ? "#{i} ERROR #{i * 7}" : "#{i} ok" }.join("\n")
+  end
+  
+  it "should find what scan finds" do
+    reg = Oniguruma::ORegexp.new('ERROR \d+|^\d+7\b')
+    expected = reg.scan(@text).map { |m| [m.begin(0), m.end(0)] }
+    reg.parallel_scan(@text, :threads => 4).should == expected
+    reg.parallel_scan(@text, :threads => 1).should == expected
+  end
+  
+  it "should split at other delimiters" do
+    reg = Oniguruma::ORegexp.new('ERROR')
+    text = @text.tr("\n", ';')
+    reg.parallel_scan(text, :delimiter => ';', :threads => 3).size.should eql(50)
+  end
+  
+  it "should find empty matches once" do
+    Oniguruma::ORegexp.new('x*').parallel_scan("ab\nc").should == [[0, 0], [1, 1], [2, 2], [3, 3], [4, 4]]
+  end
+  
+  it "should refuse patterns matching across the delimiter" do
+    lambda { Oniguruma::ORegexp.new('ok\n\d+ ERROR').parallel_scan(@text, :threads => 4) }.should raise_error(ArgumentError)
+    lambda { Oniguruma::ORegexp.new('\Gok').parallel_scan(@text) }.should raise_error(ArgumentError)
+  end
+end
+
+describe Oniguruma::ORegexp, ".match_many" do
+  before(:each) do
+    @subjects = ['Mozilla/5.0 Firefox/3.0', 'curl/7.19', 'Opera/9.6', 'Firefox/2.0 (X11)']
+    @reg = Oniguruma::ORegexp.new('(\w+)/(\d+)\.(\d+)')
+  end
+  
+  it "should answer whether each element matches" do
+    Oniguruma::ORegexp.new('Firefox').match_many(@subjects).should == [true, false, false, true]
+    Oniguruma::ORegexp.new('x').match_many([]).should == []
+  end
+  
+  it "should pack offsets of the first match" do
+    offsets = Oniguruma::ORegexp.new('Firefox/\d').match_many(@subjects, :mode => :offsets)
+    offsets.size.should eql(32)
+    offsets.unpack('l*').should == [12, 21, -1, -1, -1, -1, 0, 9]
+  end
+  
+  it "should return the groups of each match" do
+    captures = @reg.match_many(@subjects, :mode => :captures)
+    captures[1].should == ['curl/7.19', 'curl', '7', '19']
+    Oniguruma::ORegexp.new('Opera(/\d)?(x)?').match_many(@subjects, :mode => :captures).should == [nil, nil, ['Opera/9', '/9', nil], nil]
+  end
+  
+  it "should agree with match" do
+    @reg.match_many(@subjects, :mode => :captures).should == @subjects.map { |s| @reg.match(s).to_a }
+  end
+  
+  it "should reject unknown modes and non-strings" do
+    lambda { @reg.match_many(@subjects, :mode => :all) }.should raise_error(ArgumentError)
+    lambda { @reg.match_many(['a', 1]) }.should raise_error(TypeError)
+  end
+end
+
+describe Oniguruma::ORegexp, ".scan_offsets and .count" do
+  before(:each) do
+    @reg = Oniguruma::ORegexp.new('(?<key>\w)=(?<value>\d)?')
+    @text = 'a=1 b= c=3'
+  end
+  
+  it "should return flat offsets of whole matches" do
+    @reg.scan_offsets(@text).should == [0, 3, 4, 6, 7, 10]
+    @reg.scan_offsets('nothing').should == []
+  end
+  
+  it "should return offsets of the given groups" do
+    @reg.scan_offsets(@text, :groups => [1, 2]).should == [0, 1, 2, 3, 4, 5, -1, -1, 7, 8, 9, 10]
+    @reg.scan_offsets(@text, :groups => [:value]).should == [2, 3, -1, -1, 9, 10]
+    lambda { @reg.scan_offsets(@text, :groups => [3]) }.should raise_error(ArgumentError)
+    lambda { @reg.scan_offsets(@text, :groups => [:nope]) }.should raise_error(ArgumentError)
+  end
+  
+  it "should agree with scan" do
+    reg = Oniguruma::ORegexp.new('x*')
+    expected = reg.scan('axxb').map { |m| [m.begin(0), m.end(0)] }.flatten
+    reg.scan_offsets('axxb').should == expected
+    reg.count('axxb').should eql(expected.size / 2)
+  end
+  
+  it "should count matches" do
+    @reg.count(@text).should eql(3)
+    Oniguruma::ORegexp.new('^ERROR').count("ok\nERROR 1\nERROR 2\n" * 1000).should eql(2000)
+    Oniguruma::ORegexp.new('z').count(@text).should eql(0)
+  end
+end
+
+describe Oniguruma::ORegexp, ".scan_captures" do
+  before(:each) do
+    @text = 'a=1 b= c=33'
+  end
+  
+  it "should return what String#scan returns" do
+    Oniguruma::ORegexp.new('(\w)=(\d+)?').scan_captures(@text).should == @text.scan(/(\w)=(\d+)?/)
+    Oniguruma::ORegexp.new('\d+').scan_captures(@text).should == @text.scan(/\d+/)
+    Oniguruma::ORegexp.new('x*').scan_captures('ab').should == 'ab'.scan(/x*/)
+    Oniguruma::ORegexp.new('z').scan_captures(@text).should == []
+  end
+  
+  it "should yield items and return the string" do
+    items = []
+    Oniguruma::ORegexp.new('(\w)=').scan_captures(@text) { |item| items << item }.should equal(@text)
+    items.should == [['a'], ['b'], ['c']]
+  end
+  
+  it "should leave the last match alone" do
+    Oniguruma::ORegexp.new('z').match('z')
+    Oniguruma::ORegexp.new('\d').scan_captures(@text)
+    Oniguruma::ORegexp.last_match(0).should eql('z')
+  end
+end
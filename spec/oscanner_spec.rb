@@ -0,0 +1,75 @@
+require File.dirname(__FILE__) + '/spec_helper.rb'
+
+describe Oniguruma::OScanner do
+  before(:each) do
+    @scanner = Oniguruma::OScanner.new('3 + foo(4)')
+    @number  = Oniguruma::ORegexp.new('\d+')
+    @space   = Oniguruma::ORegexp.new('\s+')
+  end
+  
+  it "should only match at the scan pointer" do
+    @scanner.scan(@number).should == '3'
+    @scanner.pos.should eql(1)
+    @scanner.scan(@number).should be_nil
+    @scanner.matched?.should be_false
+    @scanner.pos.should eql(1)
+  end
+  
+  it "should skip, check and match? without creating strings or moving" do
+    @scanner.skip(@number).should eql(1)
+    @scanner.check(@space).should == ' '
+    @scanner.match?(@space).should eql(1)
+    @scanner.pos.should eql(1)
+  end
+  
+  it "should scan until a pattern" do
+    @scanner.scan_until(Oniguruma::ORegexp.new('\(')).should == '3 + foo('
+    @scanner.pre_match.should == '3 + foo'
+    @scanner.matched.should == '('
+    @scanner.post_match.should == '4)'
+    @scanner.rest.should == '4)'
+    @scanner.skip_until(Oniguruma::ORegexp.new('x')).should be_nil
+    @scanner.check_until(Oniguruma::ORegexp.new('\)')).should == '4)'
+    @scanner.pos.should eql(8)
+  end
+  
+  it "should give groups by number and name" do
+    scanner = Oniguruma::OScanner.new('width: 10px')
+    scanner.scan(Oniguruma::ORegexp.new('(?<name>\w+):\s*(?<value>\d+)'))
+    scanner[0].should == 'width: 10'
+    scanner[:name].should == 'width'
+    scanner['value'].should == '10'
+    scanner[5].should be_nil
+    scanner.matched_size.should eql(9)
+    scanner.omatch[:value].should == '10'
+  end
+  
+  it "should accept pattern strings" do
+    @scanner.scan('\d').should == '3'
+  end
+  
+  it "should tokenize like a forward search" do
+    tokens = []
+    scanner = Oniguruma::OScanner.new('x = foo(12, "a b") + 7')
+    rules = ['\s+', '\w+', '"[^"]*"', '[=(),+]'].map { |r| Oniguruma::ORegexp.new(r) }
+    until scanner.eos?
+      rule = rules.find { |r| scanner.match?(r) }
+      token = scanner.scan(rule)
+      tokens << token unless token =~ /\A\s+\z/
+    end
+    tokens.should == ['x', '=', 'foo', '(', '12', ',', '"a b"', ')', '+', '7']
+  end
+  
+  it "should move the pointer" do
+    @scanner.pos = -2
+    @scanner.scan(@number).should == '4'
+    @scanner.terminate.eos?.should be_true
+    @scanner.reset.pos.should eql(0)
+    lambda { @scanner.pos = 100 }.should raise_error(RangeError)
+  end
+  
+  it "should see through lookbehind before the pointer" do
+    @scanner.pos = 4
+    @scanner.scan(Oniguruma::ORegexp.new('(?<=\+ )\w+')).should == 'foo'
+  end
+end
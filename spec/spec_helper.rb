@@ -1,4 +1,7 @@
 require 'spec'
+require 'timeout'
+require 'stringio'
+require 'tempfile'
 
 $LOAD_PATH.unshift(File.dirname(__FILE__) +'/../ext')
 require 'oniguruma'
@@ -42,4 +42,21 @@ describe String, "Oniguruma extension" do
     do_sub(:ogsub!)
     @string.should eql('h*ll*')
   end
+  
+  it "should take per call limits" do
+    @string.ogsub('[aeiou]', '*', :timeout => 1).should eql('h*ll*')
+    @string.osub('l+', :match_limit => 0) { |s| s.upcase }.should eql('heLLo')
+    lambda { @string.ogsub('l', '*', 1) }.should raise_error(TypeError)
+  end
+  
+  it "should stop catastrophic backtracking with a per call limit" do
+    begin
+      Oniguruma::ORegexp.new('a', :match_limit => 1)
+    rescue NotImplementedError
+      pending('the linked Oniguruma has no retry limit')
+    end
+    lambda {
+      ('a' * 40 + 'b').ogsub('(a|aa)+$', 'x', :match_limit => 10_000)
+    }.should raise_error(Oniguruma::MatchTimeout)
+  end
 end